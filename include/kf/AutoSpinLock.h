@@ -1,5 +1,8 @@
 #pragma once
 #include <wdm.h>
+#ifdef KF_LOCK_STATS
+#include "SpinLock.h"
+#endif
 
 namespace kf
 {
@@ -12,17 +15,75 @@ namespace kf
             KeAcquireSpinLock(m_spinLock, &m_oldIrql);
         }
 
+#ifdef KF_LOCK_STATS
+        AutoSpinLock(_In_ SpinLock& spinLock)
+            : m_spinLock(spinLock)
+            , m_stats(&spinLock.stats())
+        {
+            acquireWithStats();
+        }
+#endif
+
         ~AutoSpinLock()
         {
+            unlock();
+        }
+
+        // Drop the spin lock for a while, e.g. to wait on a ConditionVariable, so the object is BasicLockable. The lock
+        // must be held again by the time the object is destroyed.
+        void unlock()
+        {
+#ifdef KF_LOCK_STATS
+            if (m_stats)
+            {
+                m_stats->recordHold(LockStats::now() - m_acquireTime);
+            }
+#endif
             KeReleaseSpinLock(m_spinLock, m_oldIrql);
         }
 
+        void lock()
+        {
+#ifdef KF_LOCK_STATS
+            if (m_stats)
+            {
+                acquireWithStats();
+                return;
+            }
+#endif
+            KeAcquireSpinLock(m_spinLock, &m_oldIrql);
+        }
+
     private:
         AutoSpinLock(const AutoSpinLock&) = delete;
         AutoSpinLock& operator=(const AutoSpinLock&) = delete;
 
+#ifdef KF_LOCK_STATS
+        void acquireWithStats()
+        {
+            KeRaiseIrql(DISPATCH_LEVEL, &m_oldIrql);
+
+            m_stats->acquire(true, [this](bool wait)
+            {
+                if (!wait)
+                {
+                    return !!KeTryToAcquireSpinLockAtDpcLevel(m_spinLock);
+                }
+
+                KeAcquireSpinLockAtDpcLevel(m_spinLock);
+                return true;
+            });
+
+            m_acquireTime = LockStats::now();
+        }
+#endif
+
     private:
         PKSPIN_LOCK m_spinLock;
         KIRQL       m_oldIrql;
+#ifdef KF_LOCK_STATS
+        LockStats*  m_stats = nullptr;
+        LONGLONG    m_acquireTime = 0;
+#endif
     };
 }
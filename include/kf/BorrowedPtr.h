@@ -0,0 +1,69 @@
+#pragma once
+#include "boost/intrusive_ptr.hpp"
+
+namespace kf
+{
+    //////////////////////////////////////////////////////////////////////////
+    // BorrowedPtr - non-owning view of an object kept alive by some boost::intrusive_ptr up the call stack.
+    // Passing it down instead of intrusive_ptr copies avoids touching the reference count for scoped use,
+    // retain() takes a real reference when the object has to outlive the caller's one.
+
+    template<class T>
+    class BorrowedPtr
+    {
+    public:
+        BorrowedPtr() : m_object(nullptr)
+        {
+        }
+
+        BorrowedPtr(const boost::intrusive_ptr<T>& owner) : m_object(owner.get())
+        {
+        }
+
+        template<class U>
+        BorrowedPtr(const BorrowedPtr<U>& another) : m_object(another.get())
+        {
+        }
+
+        // Borrowing from a temporary would leave the pointer dangling
+        BorrowedPtr(boost::intrusive_ptr<T>&&) = delete;
+
+        static BorrowedPtr fromRaw(T* object)
+        {
+            BorrowedPtr ptr;
+            ptr.m_object = object;
+
+            return ptr;
+        }
+
+        T* get() const
+        {
+            return m_object;
+        }
+
+        T* operator->() const
+        {
+            ASSERT(m_object);
+            return m_object;
+        }
+
+        T& operator*() const
+        {
+            ASSERT(m_object);
+            return *m_object;
+        }
+
+        explicit operator bool() const
+        {
+            return m_object != nullptr;
+        }
+
+        boost::intrusive_ptr<T> retain() const
+        {
+            return boost::intrusive_ptr<T>(m_object);
+        }
+
+    private:
+        T* m_object;
+    };
+}
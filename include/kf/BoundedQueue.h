@@ -0,0 +1,341 @@
+#pragma once
+#include <atomic>
+#include <span>
+#include <utility>
+#include "Semaphore.h"
+
+namespace kf
+{
+    using namespace std;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////////
+    // BoundedQueue - fixed-capacity FIFO queue for many producers and many consumers (Dmitry Vyukov's bounded MPMC
+    // queue). Items are moved into preallocated cells, so there is no allocation per item.
+    //
+    // Every cell has a sequence number that tells which lap of the ring it is ready for, a producer or a consumer claims
+    // a cell with one compare-exchange of the shared position and never waits for the others. Batch operations claim
+    // several consecutive cells with the same single compare-exchange.
+    //
+    // tryPush/tryPop and the batch versions do not block and can be called at IRQL <= DISPATCH_LEVEL (the cells are
+    // allocated from poolType). push/pop block at IRQL <= APC_LEVEL until there is space or an item. Blocked threads
+    // sleep on semaphores that are released only when somebody is waiting, so the non-blocking path stays free of
+    // dispatcher calls while the queue is neither empty nor full.
+    /*
+    BoundedQueue<WorkItem> queue;
+    status = queue.create(1024);
+
+    // DPC
+    if (!queue.tryPush(std::move(item))) { ++m_dropped; }
+
+    // Worker thread
+    WorkItem item;
+    queue.pop(item);
+    */
+
+    template<class T, POOL_TYPE poolType = NonPagedPoolNx>
+    class BoundedQueue
+    {
+        static_assert(alignof(T) <= MEMORY_ALLOCATION_ALIGNMENT, "Pool allocations are not aligned enough for T");
+
+    public:
+        BoundedQueue() : m_itemsAvailable(0, MAXLONG), m_spaceAvailable(0, MAXLONG)
+        {
+        }
+
+        ~BoundedQueue()
+        {
+            free();
+        }
+
+        BoundedQueue(const BoundedQueue&) = delete;
+        BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+        // Capacity must be a power of 2 and at least 2
+        NTSTATUS create(size_t capacity)
+        {
+            ASSERT(!m_cells);
+
+            if (capacity < 2 || (capacity & (capacity - 1)) || capacity > MAXSIZE_T / sizeof(Cell))
+            {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            m_cells = static_cast<Cell*>(operator new(capacity * sizeof(Cell), poolType));
+            if (!m_cells)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            for (size_t i = 0; i < capacity; ++i)
+            {
+                new(&m_cells[i].sequence) atomic<size_t>(i);
+            }
+
+            m_mask = capacity - 1;
+            m_pushPosition.store(0, memory_order_relaxed);
+            m_popPosition.store(0, memory_order_relaxed);
+
+            return STATUS_SUCCESS;
+        }
+
+        // Destroys the items left in the queue, must not race with other calls
+        void free()
+        {
+            if (m_cells)
+            {
+                const size_t pushPosition = m_pushPosition.load(memory_order_acquire);
+
+                for (size_t position = m_popPosition.load(memory_order_acquire); position != pushPosition; ++position)
+                {
+                    Cell& cell = m_cells[position & m_mask];
+                    ASSERT(cell.sequence.load(memory_order_relaxed) == position + 1);
+
+                    cell.item()->~T();
+                }
+
+                operator delete(m_cells);
+                m_cells = nullptr;
+            }
+        }
+
+        size_t capacity() const
+        {
+            return m_cells ? m_mask + 1 : 0;
+        }
+
+        // Approximate if there are concurrent calls
+        size_t size() const
+        {
+            const size_t pushPosition = m_pushPosition.load(memory_order_acquire);
+            const size_t popPosition = m_popPosition.load(memory_order_acquire);
+
+            return pushPosition > popPosition ? pushPosition - popPosition : 0;
+        }
+
+        bool tryPush(const T& item)
+        {
+            return tryPushWith([&item](void* storage) { new(storage) T(item); });
+        }
+
+        bool tryPush(T&& item)
+        {
+            return tryPushWith([&item](void* storage) { new(storage) T(std::move(item)); });
+        }
+
+        bool tryPop(_Out_ T& item)
+        {
+            size_t position;
+            if (!claim(m_popPosition, 1, 1, position))
+            {
+                return false;
+            }
+
+            popCell(position, item);
+            notify(m_pushWaiters, m_spaceAvailable, 1);
+
+            return true;
+        }
+
+        // Moves as many leading items as fit into the queue in one operation, returns their count
+        size_t tryPushMany(span<T> items)
+        {
+            size_t position;
+            const size_t count = claim(m_pushPosition, 0, items.size(), position);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                pushCell(position + i, [&item = items[i]](void* storage) { new(storage) T(std::move(item)); });
+            }
+
+            if (count)
+            {
+                notify(m_popWaiters, m_itemsAvailable, static_cast<LONG>(min<size_t>(count, MAXLONG)));
+            }
+
+            return count;
+        }
+
+        // Takes up to items.size() items in one operation, returns their count
+        size_t tryPopMany(span<T> items)
+        {
+            size_t position;
+            const size_t count = claim(m_popPosition, 1, items.size(), position);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                popCell(position + i, items[i]);
+            }
+
+            if (count)
+            {
+                notify(m_pushWaiters, m_spaceAvailable, static_cast<LONG>(min<size_t>(count, MAXLONG)));
+            }
+
+            return count;
+        }
+
+        // Returns STATUS_TIMEOUT if there is still no space when the timeout expires, the item is left intact then
+        NTSTATUS push(T&& item, _In_opt_ PLARGE_INTEGER timeout = nullptr)
+        {
+            return waitFor(m_pushWaiters, m_spaceAvailable, timeout, [&] { return tryPush(std::move(item)); });
+        }
+
+        NTSTATUS push(const T& item, _In_opt_ PLARGE_INTEGER timeout = nullptr)
+        {
+            return waitFor(m_pushWaiters, m_spaceAvailable, timeout, [&] { return tryPush(item); });
+        }
+
+        // Returns STATUS_TIMEOUT if the queue is still empty when the timeout expires
+        NTSTATUS pop(_Out_ T& item, _In_opt_ PLARGE_INTEGER timeout = nullptr)
+        {
+            return waitFor(m_popWaiters, m_itemsAvailable, timeout, [&] { return tryPop(item); });
+        }
+
+    private:
+        struct Cell
+        {
+            atomic<size_t>  sequence;
+            alignas(T) std::byte storage[sizeof(T)];
+
+            T* item()
+            {
+                return reinterpret_cast<T*>(storage);
+            }
+        };
+
+        // A cell is ready for the push at position when its sequence equals position and for the pop at position when it
+        // equals position + 1. Claims up to maxCount consecutive ready cells, returns their count.
+        size_t claim(atomic<size_t>& sharedPosition, size_t readyOffset, size_t maxCount, _Out_ size_t& position)
+        {
+            ASSERT(m_cells);
+
+            position = sharedPosition.load(memory_order_relaxed);
+
+            while (maxCount)
+            {
+                size_t count = 0;
+                while (count < maxCount && count <= m_mask && m_cells[(position + count) & m_mask].sequence.load(memory_order_acquire) == position + count + readyOffset)
+                {
+                    ++count;
+                }
+
+                if (count)
+                {
+                    if (sharedPosition.compare_exchange_weak(position, position + count, memory_order_relaxed))
+                    {
+                        return count;
+                    }
+
+                    continue;
+                }
+
+                // The first cell is either a lap behind (full for pushes, empty for pops) or already taken by another thread
+                const auto difference = static_cast<intptr_t>(m_cells[position & m_mask].sequence.load(memory_order_acquire) - (position + readyOffset));
+                if (difference < 0)
+                {
+                    break;
+                }
+
+                position = sharedPosition.load(memory_order_relaxed);
+            }
+
+            return 0;
+        }
+
+        template<class Construct>
+        bool tryPushWith(Construct construct)
+        {
+            size_t position;
+            if (!claim(m_pushPosition, 0, 1, position))
+            {
+                return false;
+            }
+
+            pushCell(position, construct);
+            notify(m_popWaiters, m_itemsAvailable, 1);
+
+            return true;
+        }
+
+        template<class Construct>
+        void pushCell(size_t position, Construct construct)
+        {
+            Cell& cell = m_cells[position & m_mask];
+
+            construct(cell.storage);
+            cell.sequence.store(position + 1, memory_order_release);
+        }
+
+        void popCell(size_t position, _Out_ T& item)
+        {
+            Cell& cell = m_cells[position & m_mask];
+
+            item = std::move(*cell.item());
+            cell.item()->~T();
+            cell.sequence.store(position + m_mask + 1, memory_order_release);
+        }
+
+        // The fence pairs with the one in waitFor: either the waiter sees the change or the notifier sees the waiter
+        static void notify(atomic<LONG>& waiters, Semaphore& semaphore, LONG count)
+        {
+            atomic_thread_fence(memory_order_seq_cst);
+
+            const LONG waitersCount = waiters.load(memory_order_relaxed);
+            if (waitersCount > 0)
+            {
+                semaphore.release(min(count, waitersCount));
+            }
+        }
+
+        template<class TryOperation>
+        static NTSTATUS waitFor(atomic<LONG>& waiters, Semaphore& semaphore, _In_opt_ PLARGE_INTEGER timeout, TryOperation tryOperation)
+        {
+            ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
+
+            // Stale permits cause extra wake-ups, a relative timeout would restart on each, so it becomes a deadline once
+            LARGE_INTEGER deadline;
+            if (timeout && timeout->QuadPart < 0)
+            {
+                KeQuerySystemTime(&deadline);
+                deadline.QuadPart -= timeout->QuadPart;
+                timeout = &deadline;
+            }
+
+            for (;;)
+            {
+                if (tryOperation())
+                {
+                    return STATUS_SUCCESS;
+                }
+
+                waiters.fetch_add(1, memory_order_relaxed);
+                atomic_thread_fence(memory_order_seq_cst);
+
+                if (tryOperation())
+                {
+                    waiters.fetch_sub(1, memory_order_relaxed);
+                    return STATUS_SUCCESS;
+                }
+
+                // A permit released for a waiter that left in between only causes one extra iteration
+                NTSTATUS status = semaphore.wait(timeout);
+                waiters.fetch_sub(1, memory_order_relaxed);
+
+                if (status == STATUS_TIMEOUT)
+                {
+                    return tryOperation() ? STATUS_SUCCESS : STATUS_TIMEOUT;
+                }
+            }
+        }
+
+    private:
+        Cell*                   m_cells = nullptr;
+        size_t                  m_mask = 0;
+        alignas(64) atomic<size_t> m_pushPosition = 0;
+        alignas(64) atomic<size_t> m_popPosition = 0;
+        alignas(64) atomic<LONG>   m_pushWaiters = 0;
+        atomic<LONG>            m_popWaiters = 0;
+        Semaphore               m_itemsAvailable;
+        Semaphore               m_spaceAvailable;
+    };
+}
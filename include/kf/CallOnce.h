@@ -0,0 +1,90 @@
+#pragma once
+#include <atomic>
+#include <type_traits>
+#include "WaitOnAddress.h"
+
+namespace kf
+{
+    using namespace std;
+
+    //////////////////////////////////////////////////////////////////////////
+    // OnceFlag, callOnce - one-time initialization in the style of std::call_once with a one-byte flag.
+    //
+    // Calls after the initialization are a single load. Concurrent callers park in the WaitOnAddress table until the
+    // routine finishes. A routine that returns NTSTATUS may fail, then the flag is reset and the next call (including
+    // one of the parked threads) runs the routine again, as std::call_once does on an exception. Must be called at
+    // IRQL <= APC_LEVEL.
+    /*
+    static OnceFlag s_once;
+    status = callOnce(s_once, [] { return loadConfiguration(); });
+    */
+
+    class OnceFlag
+    {
+    public:
+        OnceFlag()
+        {
+        }
+
+        OnceFlag(const OnceFlag&) = delete;
+        OnceFlag& operator=(const OnceFlag&) = delete;
+
+        bool isDone() const
+        {
+            return m_state.load(memory_order_acquire) == kDone;
+        }
+
+    private:
+        template<class Routine>
+        friend NTSTATUS callOnce(OnceFlag& flag, Routine&& routine);
+
+        enum : UCHAR
+        {
+            kNotStarted,
+            kRunning,
+            kDone,
+        };
+
+        atomic<UCHAR> m_state = kNotStarted;
+    };
+
+    static_assert(sizeof(OnceFlag) == 1);
+
+    // Returns the status of the routine if it ran in this call and STATUS_SUCCESS if it had already succeeded
+    template<class Routine>
+    NTSTATUS callOnce(OnceFlag& flag, Routine&& routine)
+    {
+        for (;;)
+        {
+            UCHAR state = flag.m_state.load(memory_order_acquire);
+            if (state == OnceFlag::kDone)
+            {
+                return STATUS_SUCCESS;
+            }
+
+            if (state == OnceFlag::kNotStarted && flag.m_state.compare_exchange_strong(state, OnceFlag::kRunning, memory_order_acquire))
+            {
+                NTSTATUS status = STATUS_SUCCESS;
+
+                if constexpr (is_same_v<invoke_result_t<Routine>, NTSTATUS>)
+                {
+                    status = routine();
+                }
+                else
+                {
+                    routine();
+                }
+
+                flag.m_state.store(NT_SUCCESS(status) ? OnceFlag::kDone : OnceFlag::kNotStarted, memory_order_release);
+                WaitOnAddress::wakeAll(flag.m_state);
+
+                return status;
+            }
+
+            if (state == OnceFlag::kRunning)
+            {
+                WaitOnAddress::wait(flag.m_state, OnceFlag::kRunning);
+            }
+        }
+    }
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include <cstring>
+
+namespace kf
+{
+    //////////////////////////////////////////////////////////////////////////
+    // CaseInsensitive - case-insensitive comparison of UNICODE_STRINGs with an ASCII fast path.
+    //
+    // The results are exactly the ones of RtlCompareUnicodeString/RtlEqualUnicodeString/RtlPrefixUnicodeString with
+    // CaseInSensitive = TRUE. The common prefix where both strings are pure ASCII is compared 4 characters at a time
+    // with ASCII folding (the upcase table maps only a-z in this range), the rest from the first non-ASCII character
+    // on is passed to the Rtl function, so the system upcase table stays the single source of truth.
+
+    class CaseInsensitive
+    {
+    public:
+        static int compare(_In_ const UNICODE_STRING& str1, _In_ const UNICODE_STRING& str2)
+        {
+            const size_t length1 = str1.Length / sizeof(WCHAR);
+            const size_t length2 = str2.Length / sizeof(WCHAR);
+            const size_t length = length1 < length2 ? length1 : length2;
+
+            const size_t i = equalAsciiPrefix(str1.Buffer, str2.Buffer, length);
+            if (i == length)
+            {
+                return static_cast<int>(str1.Length) - static_cast<int>(str2.Length);
+            }
+
+            if (isAscii(str1.Buffer[i]) && isAscii(str2.Buffer[i]))
+            {
+                return static_cast<int>(upcaseAscii(str1.Buffer[i])) - static_cast<int>(upcaseAscii(str2.Buffer[i]));
+            }
+
+            UNICODE_STRING rest1 = suffix(str1, i);
+            UNICODE_STRING rest2 = suffix(str2, i);
+
+            return ::RtlCompareUnicodeString(&rest1, &rest2, TRUE);
+        }
+
+        static bool equals(_In_ const UNICODE_STRING& str1, _In_ const UNICODE_STRING& str2)
+        {
+            if (str1.Length != str2.Length)
+            {
+                return false;
+            }
+
+            return equalsSameLength(str1, str2, str1.Length / sizeof(WCHAR));
+        }
+
+        static bool startsWith(_In_ const UNICODE_STRING& str, _In_ const UNICODE_STRING& prefix)
+        {
+            if (prefix.Length > str.Length)
+            {
+                return false;
+            }
+
+            return equalsSameLength(str, prefix, prefix.Length / sizeof(WCHAR));
+        }
+
+        static constexpr bool isAscii(WCHAR ch)
+        {
+            return ch < 0x80;
+        }
+
+        static constexpr WCHAR upcaseAscii(WCHAR ch)
+        {
+            return ch >= L'a' && ch <= L'z' ? static_cast<WCHAR>(ch - (L'a' - L'A')) : ch;
+        }
+
+    private:
+        // Compares the first length characters of both strings
+        static bool equalsSameLength(_In_ const UNICODE_STRING& str1, _In_ const UNICODE_STRING& str2, size_t length)
+        {
+            const size_t i = equalAsciiPrefix(str1.Buffer, str2.Buffer, length);
+            if (i == length)
+            {
+                return true;
+            }
+
+            if (isAscii(str1.Buffer[i]) && isAscii(str2.Buffer[i]))
+            {
+                return false;
+            }
+
+            UNICODE_STRING rest1 = suffix(str1, i, length);
+            UNICODE_STRING rest2 = suffix(str2, i, length);
+
+            return !!::RtlEqualUnicodeString(&rest1, &rest2, TRUE);
+        }
+
+        // Returns the number of leading characters that are ASCII in both strings and equal ignoring case
+        static size_t equalAsciiPrefix(_In_reads_(count) const WCHAR* str1, _In_reads_(count) const WCHAR* str2, size_t count)
+        {
+            constexpr ULONG64 kNonAscii = 0xff80ff80ff80ff80ULL;
+
+            size_t i = 0;
+
+            for (; i + 4 <= count; i += 4)
+            {
+                ULONG64 x;
+                ULONG64 y;
+                memcpy(&x, str1 + i, sizeof(x));
+                memcpy(&y, str2 + i, sizeof(y));
+
+                if (((x | y) & kNonAscii) || upcaseAscii4(x) != upcaseAscii4(y))
+                {
+                    break;
+                }
+            }
+
+            for (; i < count; ++i)
+            {
+                if (!isAscii(str1[i]) || !isAscii(str2[i]) || upcaseAscii(str1[i]) != upcaseAscii(str2[i]))
+                {
+                    break;
+                }
+            }
+
+            return i;
+        }
+
+        // Upcases 4 ASCII characters packed in 16-bit lanes: bit 7 of a lane is set by the additions if the character
+        // is >= 'a' and > 'z' respectively, so their xor marks a-z; lanes can not carry into each other below 0x100
+        static constexpr ULONG64 upcaseAscii4(ULONG64 x)
+        {
+            constexpr ULONG64 kLanes = 0x0001000100010001ULL;
+
+            const ULONG64 geA = x + kLanes * (0x80 - L'a');
+            const ULONG64 gtZ = x + kLanes * (0x80 - L'z' - 1);
+            const ULONG64 lower = (geA ^ gtZ) & (kLanes * 0x80);
+
+            return x - (lower >> 2);
+        }
+
+        static UNICODE_STRING suffix(_In_ const UNICODE_STRING& str, size_t from, size_t to)
+        {
+            UNICODE_STRING result;
+            result.Buffer = str.Buffer + from;
+            result.Length = static_cast<USHORT>((to - from) * sizeof(WCHAR));
+            result.MaximumLength = result.Length;
+
+            return result;
+        }
+
+        static UNICODE_STRING suffix(_In_ const UNICODE_STRING& str, size_t from)
+        {
+            return suffix(str, from, str.Length / sizeof(WCHAR));
+        }
+    };
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include "WaitOnAddress.h"
+
+namespace kf
+{
+    using namespace std;
+
+    //////////////////////////////////////////////////////////////////////////
+    // CompactMutex - one-byte exclusive lock for objects that exist in large numbers, e.g. a lock per file context
+    // where an EResource would take more space than the rest of the context.
+    //
+    // Uncontended lock and unlock are a single interlocked operation. A contended lock spins briefly and then parks in the
+    // WaitOnAddress table, unlock wakes one parked thread only if somebody has parked. The lock is not recursive and
+    // has no owner tracking. It is BasicLockable, so std::unique_lock, std::scoped_lock and ConditionVariable work with
+    // it. Must be used at IRQL <= APC_LEVEL, enter a critical region if an APC may run code that takes the lock.
+    /*
+    std::unique_lock lock(context->m_lock);
+    */
+
+    class CompactMutex
+    {
+    public:
+        CompactMutex()
+        {
+        }
+
+        CompactMutex(const CompactMutex&) = delete;
+        CompactMutex& operator=(const CompactMutex&) = delete;
+
+        void lock()
+        {
+            UCHAR expected = kUnlocked;
+            if (!m_state.compare_exchange_strong(expected, kLocked, memory_order_acquire))
+            {
+                lockContended();
+            }
+        }
+
+        bool try_lock()
+        {
+            UCHAR expected = kUnlocked;
+            return m_state.compare_exchange_strong(expected, kLocked, memory_order_acquire);
+        }
+
+        void unlock()
+        {
+            if (m_state.exchange(kUnlocked, memory_order_release) == kLockedWithWaiters)
+            {
+                WaitOnAddress::wakeOne(m_state);
+            }
+        }
+
+    private:
+        enum : UCHAR
+        {
+            kUnlocked,
+            kLocked,
+            // Somebody may be parked, unlock has to wake it
+            kLockedWithWaiters,
+        };
+
+        void lockContended()
+        {
+            // A thread that got the lock this way does not know whether others are parked, so it keeps the waiters state
+            while (m_state.exchange(kLockedWithWaiters, memory_order_acquire) != kUnlocked)
+            {
+                WaitOnAddress::wait(m_state, kLockedWithWaiters);
+            }
+        }
+
+    private:
+        atomic<UCHAR> m_state = kUnlocked;
+    };
+
+    static_assert(sizeof(CompactMutex) == 1);
+}
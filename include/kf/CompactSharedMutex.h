@@ -0,0 +1,133 @@
+#pragma once
+#include <atomic>
+#include "WaitOnAddress.h"
+
+namespace kf
+{
+    using namespace std;
+
+    //////////////////////////////////////////////////////////////////////////
+    // CompactSharedMutex - 4-byte reader/writer lock, the shared counterpart of CompactMutex.
+    //
+    // The state word holds the writer bit, the waiters bit and the reader count. Uncontended acquire and release are a
+    // single interlocked operation. Contended threads park in the WaitOnAddress table and are all woken when the lock
+    // becomes free, then compete again. New readers park while anybody is parked, so a stream of readers does not
+    // starve a writer. It satisfies the SharedLockable requirements, so std::unique_lock and std::shared_lock work with
+    // it. Must be used at IRQL <= APC_LEVEL, it is not recursive and can not be upgraded.
+    /*
+    std::shared_lock lock(context->m_lock);
+    */
+
+    class CompactSharedMutex
+    {
+    public:
+        CompactSharedMutex()
+        {
+        }
+
+        CompactSharedMutex(const CompactSharedMutex&) = delete;
+        CompactSharedMutex& operator=(const CompactSharedMutex&) = delete;
+
+        void lock()
+        {
+            ULONG expected = 0;
+            if (!m_state.compare_exchange_strong(expected, kWriter, memory_order_acquire))
+            {
+                lockContended([](ULONG state) { return !(state & (kWriter | kReaderMask)); }, kWriter);
+            }
+        }
+
+        bool try_lock()
+        {
+            ULONG expected = 0;
+            return m_state.compare_exchange_strong(expected, kWriter, memory_order_acquire);
+        }
+
+        void unlock()
+        {
+            // Clears the writer and the waiters bits, readers can not be there
+            if (m_state.exchange(0, memory_order_release) & kWaiters)
+            {
+                WaitOnAddress::wakeAll(m_state);
+            }
+        }
+
+        void lock_shared()
+        {
+            if (!try_lock_shared())
+            {
+                lockContended([](ULONG state) { return !(state & (kWriter | kWaiters)) && (state & kReaderMask) != kReaderMask; }, kReader);
+            }
+        }
+
+        bool try_lock_shared()
+        {
+            ULONG state = m_state.load(memory_order_relaxed);
+
+            while (!(state & (kWriter | kWaiters)) && (state & kReaderMask) != kReaderMask)
+            {
+                if (m_state.compare_exchange_weak(state, state + kReader, memory_order_acquire, memory_order_relaxed))
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void unlock_shared()
+        {
+            ULONG state = m_state.fetch_sub(kReader, memory_order_release) - kReader;
+
+            // The last reader hands the lock over to the parked threads
+            while ((state & kWaiters) && !(state & kReaderMask))
+            {
+                if (m_state.compare_exchange_weak(state, state & ~kWaiters, memory_order_relaxed))
+                {
+                    WaitOnAddress::wakeAll(m_state);
+                    break;
+                }
+            }
+        }
+
+    private:
+        static constexpr ULONG kWriter = 1;
+        // Set only while the lock is held
+        static constexpr ULONG kWaiters = 2;
+        static constexpr ULONG kReader = 4;
+        static constexpr ULONG kReaderMask = ~(kWriter | kWaiters);
+
+        template<class CanAcquire>
+        void lockContended(CanAcquire canAcquire, ULONG increment)
+        {
+            ULONG state = m_state.load(memory_order_relaxed);
+
+            for (;;)
+            {
+                if (canAcquire(state))
+                {
+                    if (m_state.compare_exchange_weak(state, state + increment, memory_order_acquire, memory_order_relaxed))
+                    {
+                        return;
+                    }
+
+                    continue;
+                }
+
+                // Announces the parked thread to the holders, which are there as the state can not be acquired
+                if (!(state & kWaiters) && !m_state.compare_exchange_weak(state, state | kWaiters, memory_order_relaxed))
+                {
+                    continue;
+                }
+
+                WaitOnAddress::wait(m_state, state | kWaiters);
+                state = m_state.load(memory_order_relaxed);
+            }
+        }
+
+    private:
+        atomic<ULONG> m_state = 0;
+    };
+
+    static_assert(sizeof(CompactSharedMutex) == 4);
+}
@@ -1,18 +1,37 @@
 #pragma once
-
+#include <type_traits>
 #include "EResource.h"
-#include "Semaphore.h"
+#include "SpinLock.h"
+#include "AutoSpinLock.h"
+#include "DoubleLinkedList.h"
 
 namespace kf
 {
     //////////////////////////////////////////////////////////////////////////
     // ConditionVariable
+    //
+    // Every waiter queues a node with its own KEVENT on its stack. notifyOne() wakes the longest waiting thread and
+    // notifyAll() wakes exactly the threads that wait at the moment of the call, a thread that starts waiting later can
+    // not steal the notification. Notify can be called at IRQL <= DISPATCH_LEVEL, with or without the external lock.
+    //
+    // The external lock is an EResource (FltResource), which is released and reacquired exclusively, or any
+    // BasicLockable: std::unique_lock, std::shared_lock, AutoSpinLock, etc. Waiting itself is done at IRQL <= APC_LEVEL,
+    // that is after the lock is released.
+    /*
+    AutoSpinLock lock(m_lock);
+    m_condition.wait(lock, [this] { return !m_queue.isEmpty(); });
+    */
 
     class ConditionVariable
     {
     public:
-        ConditionVariable() : m_semaphore(0, MAXLONG)
+        ConditionVariable()
+        {
+        }
+
+        ~ConditionVariable()
         {
+            ASSERT(m_waiters.isEmpty());
         }
 
         ConditionVariable(const ConditionVariable&) = delete;
@@ -24,32 +43,60 @@ namespace kf
             Success
         };
 
-        void wait(EResource& external)
+        template<class Lock>
+        void wait(Lock& external)
         {
             waitFor(external, nullptr);
         }
 
-        template<class Predicate>
-        void wait(EResource& external, Predicate predicate)
+        template<class Lock, class Predicate>
+        void wait(Lock& external, Predicate predicate)
         {
             waitFor(external, nullptr, predicate);
         }
 
-        Status waitFor(EResource& external, PLARGE_INTEGER timeout)
+        template<class Lock>
+        Status waitFor(Lock& external, PLARGE_INTEGER timeout)
         {
-            ++m_waitersCount;
+            Waiter waiter;
+            {
+                AutoSpinLock lock(m_lock);
+                m_waiters.addLast(waiter);
+            }
+
+            release(external);
+            ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
 
-            external.release();
-            auto status = NT_SUCCESS(m_semaphore.wait(timeout)) ? Status::Success : Status::Timeout;
-            external.acquireExclusive();
+            auto status = KeWaitForSingleObject(&waiter.m_event, Executive, KernelMode, false, timeout) == STATUS_TIMEOUT ? Status::Timeout : Status::Success;
+            if (status == Status::Timeout)
+            {
+                bool notified;
+                {
+                    AutoSpinLock lock(m_lock);
+
+                    notified = waiter.m_notified;
+                    if (!notified)
+                    {
+                        m_waiters.remove(waiter);
+                    }
+                }
 
-            --m_waitersCount;
+                if (notified)
+                {
+                    // The notifier has already dequeued the waiter and is about to set the event, the node must live
+                    // till then. The notification is not lost, the wait counts as a success.
+                    KeWaitForSingleObject(&waiter.m_event, Executive, KernelMode, false, nullptr);
+                    status = Status::Success;
+                }
+            }
+
+            acquire(external);
 
             return status;
         }
 
-        template<class Predicate>
-        bool waitFor(EResource& external, PLARGE_INTEGER timeout, Predicate predicate)
+        template<class Lock, class Predicate>
+        bool waitFor(Lock& external, PLARGE_INTEGER timeout, Predicate predicate)
         {
             while (!predicate())
             {
@@ -64,24 +111,93 @@ namespace kf
 
         void notifyOne()
         {
-            auto waitersCount = m_waitersCount.load();
-            if (waitersCount > 0)
+            Waiter* waiter;
+            {
+                AutoSpinLock lock(m_lock);
+
+                waiter = m_waiters.removeFirst();
+                if (waiter)
+                {
+                    waiter->m_notified = true;
+                }
+            }
+
+            if (waiter)
             {
-                m_semaphore.release();
+                waiter->signal();
             }
         }
 
         void notifyAll()
         {
-            auto waitersCount = m_waitersCount.load();
-            if (waitersCount > 0)
+            WaiterList waiters;
+            {
+                AutoSpinLock lock(m_lock);
+
+                for (auto& waiter : m_waiters)
+                {
+                    waiter.m_notified = true;
+                }
+
+                waiters = m_waiters.takeAll();
+            }
+
+            // A waiter may leave as soon as its event is set, so it is dequeued before
+            while (auto waiter = waiters.removeFirst())
+            {
+                waiter->signal();
+            }
+        }
+
+    private:
+        struct Waiter
+        {
+            Waiter()
+            {
+                KeInitializeEvent(&m_event, NotificationEvent, false);
+            }
+
+            void signal()
+            {
+                KeSetEvent(&m_event, IO_NO_INCREMENT, false);
+            }
+
+            DoubleLinkedListEntry   m_entry;
+            KEVENT                  m_event;
+            // Set under m_lock when the waiter is dequeued by notify
+            bool                    m_notified = false;
+        };
+
+        typedef DoubleLinkedList<Waiter, &Waiter::m_entry> WaiterList;
+
+        template<class Lock>
+        static void release(Lock& external)
+        {
+            if constexpr (std::is_base_of_v<EResource, Lock>)
+            {
+                external.release();
+            }
+            else
+            {
+                external.unlock();
+            }
+        }
+
+        template<class Lock>
+        static void acquire(Lock& external)
+        {
+            if constexpr (std::is_base_of_v<EResource, Lock>)
+            {
+                external.acquireExclusive();
+            }
+            else
             {
-                m_semaphore.release(waitersCount);
+                external.lock();
             }
         }
 
     private:
-        std::atomic_long m_waitersCount = 0;
-        Semaphore m_semaphore;
+        SpinLock    m_lock;
+        WaiterList  m_waiters;
     };
 }
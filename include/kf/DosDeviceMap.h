@@ -0,0 +1,222 @@
+#pragma once
+#include "FilenameUtils.h"
+#include "ObjectAttributes.h"
+#include "EResource.h"
+#include "EResourceSharedLock.h"
+#include "EResourceExclusiveLock.h"
+
+namespace kf
+{
+    ///////////////////////////////////////////////////////////////////////////////////////////////////
+    // DosDeviceMap - DOS to NT name conversion that maps drive letters to device names, e.g. "C:\\dir" to
+    // "\\Device\\HarddiskVolume3\\dir" instead of "\\??\\C:\\dir".
+    //
+    // A drive letter is resolved by querying the "\\??\\X:" symbolic link once and then cached, a missing drive is
+    // cached too and converts as FilenameUtils::dosNameToNative does. Links are resolved in the object namespace of
+    // the calling thread, that is the global one for system threads. Call invalidate() when drive letters change.
+    // All methods must be called at PASSIVE_LEVEL.
+
+    template<POOL_TYPE poolType = PagedPool>
+    class DosDeviceMap
+    {
+    public:
+        DosDeviceMap()
+        {
+        }
+
+        DosDeviceMap(const DosDeviceMap&) = delete;
+        DosDeviceMap& operator=(const DosDeviceMap&) = delete;
+
+        NTSTATUS dosNameToNative(const USimpleString& dosFilename, _Out_ UString<poolType>& nativeFilename)
+        {
+            NTSTATUS status = resolve(driveMask(span{ &dosFilename, 1 }));
+            if (!NT_SUCCESS(status))
+            {
+                nativeFilename.free();
+                return status;
+            }
+
+            EResourceSharedLock lock(m_lock);
+
+            USimpleString prefix;
+            USimpleString rest;
+            split(dosFilename, prefix, rest);
+
+            UStringBuilder<poolType> builder;
+
+            status = builder.append(prefix, rest);
+            if (!NT_SUCCESS(status))
+            {
+                nativeFilename.free();
+                return status;
+            }
+
+            nativeFilename = std::move(builder.string());
+            return STATUS_SUCCESS;
+        }
+
+        // See FilenameUtils::dosNamesToNative, drive letters are resolved once per batch
+        NTSTATUS dosNamesToNative(span<const USimpleString> dosFilenames, span<USimpleString> nativeFilenames, _Out_ scoped_buffer<WCHAR, poolType>& arena)
+        {
+            arena.clear();
+
+            NTSTATUS status = resolve(driveMask(dosFilenames));
+            if (!NT_SUCCESS(status))
+            {
+                return status;
+            }
+
+            EResourceSharedLock lock(m_lock);
+
+            return FilenameUtils::dosNamesToNative(dosFilenames, nativeFilenames, arena, [this](const USimpleString& dosFilename, USimpleString& prefix, USimpleString& rest)
+            {
+                split(dosFilename, prefix, rest);
+            });
+        }
+
+        // Forgets all resolved drive letters
+        void invalidate()
+        {
+            EResourceExclusiveLock lock(m_lock);
+
+            for (auto& device : m_devices)
+            {
+                device.free();
+            }
+
+            m_resolved = 0;
+        }
+
+    private:
+        static constexpr int kDriveCount = 'Z' - 'A' + 1;
+
+        // Returns the index of the drive letter if the rest of a name split by FilenameUtils::splitDosName is a drive
+        // path like "C:" or "C:\\dir"
+        static int driveIndex(const USimpleString& rest)
+        {
+            if (rest.charLength() < 2 || rest.charAt(1) != L':' || (rest.charLength() > 2 && rest.charAt(2) != L'\\'))
+            {
+                return -1;
+            }
+
+            const WCHAR letter = CaseInsensitive::upcaseAscii(rest.charAt(0));
+            return letter >= L'A' && letter <= L'Z' ? letter - L'A' : -1;
+        }
+
+        static ULONG driveMask(span<const USimpleString> dosFilenames)
+        {
+            ULONG mask = 0;
+
+            for (const auto& dosFilename : dosFilenames)
+            {
+                USimpleString prefix;
+                USimpleString rest;
+                FilenameUtils::splitDosName(dosFilename, prefix, rest);
+
+                const int index = driveIndex(rest);
+                if (index >= 0)
+                {
+                    mask |= 1UL << index;
+                }
+            }
+
+            return mask;
+        }
+
+        // Must be called under the lock
+        void split(const USimpleString& dosFilename, _Out_ USimpleString& prefix, _Out_ USimpleString& rest)
+        {
+            FilenameUtils::splitDosName(dosFilename, prefix, rest);
+
+            const int index = driveIndex(rest);
+            if (index >= 0 && !m_devices[index].isEmpty())
+            {
+                prefix.setString(m_devices[index]);
+                rest = rest.substring(2);
+            }
+        }
+
+        NTSTATUS resolve(ULONG mask)
+        {
+            {
+                EResourceSharedLock lock(m_lock);
+
+                mask &= ~m_resolved;
+                if (!mask)
+                {
+                    return STATUS_SUCCESS;
+                }
+            }
+
+            EResourceExclusiveLock lock(m_lock);
+
+            for (int index = 0; index < kDriveCount; ++index)
+            {
+                if (!(mask & (1UL << index)) || (m_resolved & (1UL << index)))
+                {
+                    continue;
+                }
+
+                NTSTATUS status = queryDevice(static_cast<WCHAR>(L'A' + index), m_devices[index]);
+                if (!NT_SUCCESS(status) && status != STATUS_OBJECT_NAME_NOT_FOUND && status != STATUS_OBJECT_TYPE_MISMATCH)
+                {
+                    return status;
+                }
+
+                m_resolved |= 1UL << index;
+            }
+
+            return STATUS_SUCCESS;
+        }
+
+        static NTSTATUS queryDevice(WCHAR letter, _Out_ UString<poolType>& device)
+        {
+            device.free();
+
+            WCHAR linkBuffer[] = L"\\??\\X:";
+            linkBuffer[4] = letter;
+
+            UNICODE_STRING linkName = { sizeof(linkBuffer) - sizeof(WCHAR), sizeof(linkBuffer), linkBuffer };
+            ObjectAttributes oa(&linkName, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE);
+
+            HANDLE link = nullptr;
+            NTSTATUS status = ZwOpenSymbolicLinkObject(&link, GENERIC_READ, &oa);
+            if (!NT_SUCCESS(status))
+            {
+                return status;
+            }
+
+            UNICODE_STRING target = {};
+            ULONG targetLength = 0;
+
+            status = ZwQuerySymbolicLinkObject(link, &target, &targetLength);
+            if (status == STATUS_BUFFER_TOO_SMALL && targetLength && targetLength <= MAXUSHORT)
+            {
+                status = device.realloc(static_cast<int>(targetLength));
+                if (NT_SUCCESS(status))
+                {
+                    status = ZwQuerySymbolicLinkObject(link, &device.string(), nullptr);
+                }
+            }
+            else if (NT_SUCCESS(status))
+            {
+                status = STATUS_OBJECT_NAME_NOT_FOUND;
+            }
+
+            ZwClose(link);
+
+            if (!NT_SUCCESS(status))
+            {
+                device.free();
+            }
+
+            return status;
+        }
+
+    private:
+        EResource           m_lock;
+        UString<poolType>   m_devices[kDriveCount];
+        // Drive letters queried since the last invalidate(), including missing ones
+        ULONG               m_resolved = 0;
+    };
+}
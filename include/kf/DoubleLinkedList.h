@@ -3,11 +3,24 @@
 #include "DoubleLinkedListIterator.h"
 #include "DoubleLinkedListDescendingIterator.h"
 #include "DoubleLinkedListConstIterator.h"
+#include "DoubleLinkedListRangeIterator.h"
 
 namespace kf
 {
     //////////////////////////////////////////////////////////////////////////
     // DoubleLinkedList
+    //
+    // Intrusive list over LIST_ENTRY with an element count, so size() and the bulk transfers are O(1). To process a
+    // shared list outside of its lock take all the elements into a local one:
+    /*
+    RequestList completed;
+    {
+        AutoSpinLock lock(m_lock);
+        completed = m_completed.takeAll();
+    }
+
+    for (auto& request : completed) { ... }
+    */
 
     template<class TElemType, DoubleLinkedListEntry TElemType::* TListEntryMember>
     class DoubleLinkedList
@@ -16,6 +29,8 @@ namespace kf
         typedef DoubleLinkedListIterator<TElemType, TListEntryMember> Iterator;
         typedef DoubleLinkedListConstIterator<TElemType, TListEntryMember> ConstIterator;
         typedef DoubleLinkedListDescendingIterator<TElemType, TListEntryMember> DescendingIterator;
+        typedef DoubleLinkedListRangeIterator<TElemType, TElemType, TListEntryMember> RangeIterator;
+        typedef DoubleLinkedListRangeIterator<const TElemType, TElemType, TListEntryMember> ConstRangeIterator;
 
     public:
         DoubleLinkedList()
@@ -36,27 +51,11 @@ namespace kf
         {
             if (this != &other)
             {
-                if (!other.isEmpty())
-                {
-                    LIST_ENTRY* next = other.m_head.Flink;
-                    LIST_ENTRY* prev = other.m_head.Blink;
-
-                    next->Blink = &m_head;
-                    prev->Flink = &m_head;
-
-                    m_head.Flink = next;
-                    m_head.Blink = prev;
-
-                    ::InitializeListHead(&other.m_head);
-                }
-                else
-                {
-                    ::InitializeListHead(&m_head);
-                }
+                clear();
+                spliceAll(other);
             }
 
             return *this;
-
         }
 
         void addFirst(_Inout_ TElemType& listElement)
@@ -65,6 +64,7 @@ namespace kf
             ASSERT(::IsListEmpty(listEntry));
 
             ::InsertHeadList(&m_head, listEntry);
+            ++m_size;
         }
 
         void addLast(_Inout_ TElemType& listElement)
@@ -73,9 +73,11 @@ namespace kf
             ASSERT(::IsListEmpty(listEntry));
 
             ::InsertTailList(&m_head, listEntry);
+            ++m_size;
         }
 
-        static void addBefore(_Inout_ TElemType& existingListElement, _Inout_ TElemType& newListElement)
+        // existingListElement must be in this list
+        void addBefore(_Inout_ TElemType& existingListElement, _Inout_ TElemType& newListElement)
         {
             auto newListEntry = toListEntry(newListElement);
             ASSERT(::IsListEmpty(newListEntry));
@@ -84,9 +86,11 @@ namespace kf
             ASSERT(!::IsListEmpty(existingListEntry));
 
             ::InsertTailList(existingListEntry, newListEntry);
+            ++m_size;
         }
 
-        static void addAfter(_Inout_ TElemType& existingListElement, _Inout_ TElemType& newListElement)
+        // existingListElement must be in this list
+        void addAfter(_Inout_ TElemType& existingListElement, _Inout_ TElemType& newListElement)
         {
             auto newListEntry = toListEntry(newListElement);
             ASSERT(::IsListEmpty(newListEntry));
@@ -95,6 +99,7 @@ namespace kf
             ASSERT(!::IsListEmpty(existingListEntry));
 
             ::InsertHeadList(existingListEntry, newListEntry);
+            ++m_size;
         }
 
         TElemType* removeFirst()
@@ -107,9 +112,57 @@ namespace kf
                 return nullptr;
             }
 
+            --m_size;
             return fromListEntry(listEntry);
         }
 
+        // Appends the elements of the other list in O(1) and leaves it empty
+        void spliceAll(_Inout_ DoubleLinkedList& other)
+        {
+            ASSERT(this != &other);
+
+            if (other.isEmpty())
+            {
+                return;
+            }
+
+            LIST_ENTRY* first = other.m_head.Flink;
+            LIST_ENTRY* last = other.m_head.Blink;
+
+            first->Blink = m_head.Blink;
+            m_head.Blink->Flink = first;
+
+            last->Flink = &m_head;
+            m_head.Blink = last;
+
+            m_size += other.m_size;
+
+            ::InitializeListHead(&other.m_head);
+            other.m_size = 0;
+        }
+
+        // Moves the element from the other list to the end of this one
+        void splice(_Inout_ DoubleLinkedList& other, _Inout_ TElemType& listElement)
+        {
+            auto listEntry = toListEntry(listElement);
+            ASSERT(!::IsListEmpty(listEntry));
+
+            ::RemoveEntryList(listEntry);
+            --other.m_size;
+
+            ::InsertTailList(&m_head, listEntry);
+            ++m_size;
+        }
+
+        // Detaches all the elements in O(1), e.g. to process them after releasing the lock that guards this list
+        DoubleLinkedList takeAll()
+        {
+            DoubleLinkedList list;
+            list.spliceAll(*this);
+
+            return list;
+        }
+
         bool isEmpty() const
         {
             return !!::IsListEmpty(&m_head);
@@ -117,14 +170,7 @@ namespace kf
 
         int size() const
         {
-            int size = 0;
-
-            for (auto current = m_head.Flink; current != &m_head; current = current->Flink)
-            {
-                ++size;
-            }
-
-            return size;
+            return m_size;
         }
 
         int indexOf(const TElemType& listElement) const
@@ -150,6 +196,7 @@ namespace kf
             return indexOf(listElement) >= 0;
         }
 
+        // listElement must be in this list or in none
         bool remove(_Inout_ TElemType& listElement)
         {
             auto listEntry = toListEntry(listElement);
@@ -161,22 +208,20 @@ namespace kf
 
             ::RemoveEntryList(listEntry);
             ::InitializeListHead(listEntry);
+            --m_size;
             return true;
         }
 
         void clear()
         {
-            auto it = iterator();
-            while (it.hasNext())
+            while (removeFirst())
             {
-                it.next(); // must be called before you can call it.remove()
-                it.remove();
             }
         }
 
         Iterator iterator()
         {
-            return Iterator(&m_head);
+            return Iterator(&m_head, &m_size);
         }
 
         ConstIterator iterator() const
@@ -189,12 +234,12 @@ namespace kf
             auto listEntry = toListEntry(listElement);
             ASSERT(!::IsListEmpty(listEntry));
 
-            return Iterator(&m_head, listEntry);
+            return Iterator(&m_head, &m_size, listEntry);
         }
 
         DescendingIterator descendingIterator()
         {
-            return DescendingIterator(&m_head);
+            return DescendingIterator(&m_head, &m_size);
         }
 
         DescendingIterator descendingIterator(_Inout_ TElemType& listElement)
@@ -202,7 +247,27 @@ namespace kf
             auto listEntry = toListEntry(listElement);
             ASSERT(!::IsListEmpty(listEntry));
 
-            return DescendingIterator(&m_head, listEntry);
+            return DescendingIterator(&m_head, &m_size, listEntry);
+        }
+
+        RangeIterator begin()
+        {
+            return RangeIterator(m_head.Flink);
+        }
+
+        RangeIterator end()
+        {
+            return RangeIterator(&m_head);
+        }
+
+        ConstRangeIterator begin() const
+        {
+            return ConstRangeIterator(m_head.Flink);
+        }
+
+        ConstRangeIterator end() const
+        {
+            return ConstRangeIterator(&m_head);
         }
 
     private:
@@ -228,5 +293,6 @@ namespace kf
 
     private:
         DoubleLinkedListEntry m_head;
+        int m_size = 0;
     };
 }
@@ -9,11 +9,11 @@ namespace kf
     class DoubleLinkedListIterator
     {
     public:
-        DoubleLinkedListIterator(_Inout_ LIST_ENTRY* head) : m_head(head), m_current(m_head)
+        DoubleLinkedListIterator(_Inout_ LIST_ENTRY* head, _Inout_ int* size) : m_head(head), m_current(m_head), m_size(size)
         {
         }
 
-        DoubleLinkedListIterator(_Inout_ LIST_ENTRY* head, _Inout_ LIST_ENTRY* current) : m_head(head), m_current(current)
+        DoubleLinkedListIterator(_Inout_ LIST_ENTRY* head, _Inout_ int* size, _Inout_ LIST_ENTRY* current) : m_head(head), m_current(current), m_size(size)
         {
         }
 
@@ -39,6 +39,7 @@ namespace kf
 
             ::RemoveEntryList(listEntry);
             ::InitializeListHead(listEntry);
+            --*m_size;
         }
 
     private:
@@ -51,5 +52,7 @@ namespace kf
     private:
         LIST_ENTRY* m_head;
         LIST_ENTRY* m_current;
+        // Element count of the list, kept up to date by remove()
+        int*        m_size;
     };
 }
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+#include <iterator>
+#include <type_traits>
+
+namespace kf
+{
+    using namespace std;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////////
+    // DoubleLinkedListRangeIterator - bidirectional STL iterator for range-based for loops and std algorithms. TValue is
+    // TElemType or const TElemType. Removing the current element invalidates the iterator, use Iterator::remove() then.
+
+    template<class TValue, class TElemType, DoubleLinkedListEntry TElemType::* TListEntryMember>
+    class DoubleLinkedListRangeIterator
+    {
+        typedef conditional_t<is_const_v<TValue>, const LIST_ENTRY, LIST_ENTRY> TListEntry;
+
+    public:
+        typedef bidirectional_iterator_tag iterator_category;
+        typedef TValue value_type;
+        typedef ptrdiff_t difference_type;
+        typedef TValue* pointer;
+        typedef TValue& reference;
+
+    public:
+        DoubleLinkedListRangeIterator() : m_current()
+        {
+        }
+
+        explicit DoubleLinkedListRangeIterator(_In_ TListEntry* current) : m_current(current)
+        {
+        }
+
+        reference operator*() const
+        {
+            return *fromListEntry(m_current);
+        }
+
+        pointer operator->() const
+        {
+            return fromListEntry(m_current);
+        }
+
+        DoubleLinkedListRangeIterator& operator++()
+        {
+            m_current = m_current->Flink;
+            return *this;
+        }
+
+        DoubleLinkedListRangeIterator operator++(int)
+        {
+            auto prev = *this;
+            m_current = m_current->Flink;
+            return prev;
+        }
+
+        DoubleLinkedListRangeIterator& operator--()
+        {
+            m_current = m_current->Blink;
+            return *this;
+        }
+
+        DoubleLinkedListRangeIterator operator--(int)
+        {
+            auto prev = *this;
+            m_current = m_current->Blink;
+            return prev;
+        }
+
+        bool operator==(const DoubleLinkedListRangeIterator& other) const
+        {
+            return m_current == other.m_current;
+        }
+
+        bool operator!=(const DoubleLinkedListRangeIterator& other) const
+        {
+            return m_current != other.m_current;
+        }
+
+    private:
+        static TValue* fromListEntry(_In_ TListEntry* listEntry)
+        {
+            // Implementation of CONTAINING_RECORD macro
+            return reinterpret_cast<TValue*>(reinterpret_cast<conditional_t<is_const_v<TValue>, const char, char>*>(listEntry) - reinterpret_cast<ULONG_PTR>(&(static_cast<TElemType*>(0)->*TListEntryMember)));
+        }
+
+    private:
+        TListEntry* m_current;
+    };
+}
@@ -1,4 +1,7 @@
 #pragma once
+#ifdef KF_LOCK_STATS
+#include "LockStats.h"
+#endif
 
 namespace kf
 {
@@ -38,12 +41,34 @@ namespace kf
         void fltAcquireShared();
         void fltRelease();
 
+#ifdef KF_LOCK_STATS
+        LockStats& stats()
+        {
+            return m_stats;
+        }
+#endif
+
     private:
         EResource(const EResource&);
         EResource& operator=(const EResource&);
 
+#ifdef KF_LOCK_STATS
+        // A shared acquisition by the exclusive owner is recursive, its release must not end the exclusive hold
+        void extendExclusiveHold()
+        {
+            const auto thread = ::ExGetCurrentResourceThread();
+            if (m_stats.isExclusiveOwner(thread))
+            {
+                m_stats.beginExclusiveHold(thread);
+            }
+        }
+#endif
+
     private:
         ERESOURCE m_resource;
+#ifdef KF_LOCK_STATS
+        LockStats m_stats;
+#endif
     };
 
     ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -66,39 +91,96 @@ namespace kf
 
     inline bool EResource::acquireExclusive(_In_ _Literal_ bool wait)
     {
+#ifdef KF_LOCK_STATS
+        if (!m_stats.acquire(wait, [this](bool wait) { return !!::ExAcquireResourceExclusiveLite(&m_resource, wait); }))
+        {
+            return false;
+        }
+
+        m_stats.beginExclusiveHold(::ExGetCurrentResourceThread());
+        return true;
+#else
         return !!::ExAcquireResourceExclusiveLite(&m_resource, wait);
+#endif
     }
 
     inline bool EResource::acquireShared(_In_ bool wait)
     {
+#ifdef KF_LOCK_STATS
+        if (!m_stats.acquire(wait, [this](bool wait) { return !!::ExAcquireResourceSharedLite(&m_resource, wait); }))
+        {
+            return false;
+        }
+
+        extendExclusiveHold();
+        return true;
+#else
         return !!::ExAcquireResourceSharedLite(&m_resource, wait);
+#endif
     }
 
     inline bool EResource::acquireSharedStarveExclusive(_In_ bool wait)
     {
+#ifdef KF_LOCK_STATS
+        if (!m_stats.acquire(wait, [this](bool wait) { return !!::ExAcquireSharedStarveExclusive(&m_resource, wait); }))
+        {
+            return false;
+        }
+
+        extendExclusiveHold();
+        return true;
+#else
         return !!::ExAcquireSharedStarveExclusive(&m_resource, wait);
+#endif
     }
 
     inline bool EResource::acquireSharedWaitForExclusive(_In_ bool wait)
     {
+#ifdef KF_LOCK_STATS
+        if (!m_stats.acquire(wait, [this](bool wait) { return !!::ExAcquireSharedWaitForExclusive(&m_resource, wait); }))
+        {
+            return false;
+        }
+
+        extendExclusiveHold();
+        return true;
+#else
         return !!::ExAcquireSharedWaitForExclusive(&m_resource, wait);
+#endif
     }
 
     _Requires_lock_held_(m_resource)
     inline void EResource::convertExclusiveToShared()
     {
+#ifdef KF_LOCK_STATS
+        // All the recursive acquisitions become shared at once
+        m_stats.endAllExclusiveHolds();
+#endif
         ::ExConvertExclusiveToSharedLite(&m_resource);
     }
 
     _Requires_lock_held_(m_resource)
     inline void EResource::release()
     {
+#ifdef KF_LOCK_STATS
+        // Hold time is tracked for exclusive ownership only, shared owners have nowhere to keep a timestamp
+        if (m_stats.isExclusiveOwner(::ExGetCurrentResourceThread()))
+        {
+            m_stats.endExclusiveHold();
+        }
+#endif
         ::ExReleaseResourceLite(&m_resource);
     }
 
     _Requires_lock_held_(m_resource)
     inline void EResource::releaseForThread(ERESOURCE_THREAD resourceThreadId)
     {
+#ifdef KF_LOCK_STATS
+        if (m_stats.isExclusiveOwner(resourceThreadId))
+        {
+            m_stats.endExclusiveHold();
+        }
+#endif
         ::ExReleaseResourceForThreadLite(&m_resource, resourceThreadId);
     }
 
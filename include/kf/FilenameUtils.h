@@ -1,5 +1,7 @@
 #pragma once
 #include "USimpleString.h"
+#include "UStringBuilder.h"
+#include "ScopedBuffer.h"
 #include <utility>
 
 namespace kf
@@ -128,26 +130,141 @@ namespace kf
         template<POOL_TYPE poolType>
         static UString<poolType> dosNameToNative(const USimpleString& dosFilename)
         {
-            static const UNICODE_STRING kExtendedPathPrefix = RTL_CONSTANT_STRING(L"\\\\?\\");
-            static const UNICODE_STRING kNtPrefix = RTL_CONSTANT_STRING(L"\\??\\");
-            static const UNICODE_STRING kUncPrefix = RTL_CONSTANT_STRING(L"\\\\");
+            UString<poolType> nativeFilename;
+            dosNameToNative(dosFilename, nativeFilename);
 
-            UStringBuilder<poolType> nativeFilename;
+            return nativeFilename;
+        }
+
+        template<POOL_TYPE poolType>
+        static NTSTATUS dosNameToNative(const USimpleString& dosFilename, _Out_ UString<poolType>& nativeFilename)
+        {
+            USimpleString prefix;
+            USimpleString rest;
+            splitDosName(dosFilename, prefix, rest);
+
+            UStringBuilder<poolType> builder;
+
+            NTSTATUS status = builder.append(prefix, rest);
+            if (!NT_SUCCESS(status))
+            {
+                nativeFilename.free();
+                return status;
+            }
+
+            nativeFilename = std::move(builder.string());
+            return STATUS_SUCCESS;
+        }
+
+        // Writes the dosNameToNative result into the caller buffer without allocations
+        static NTSTATUS dosNameToNative(const USimpleString& dosFilename, span<WCHAR> buffer, _Out_ USimpleString& nativeFilename)
+        {
+            USimpleString prefix;
+            USimpleString rest;
+            splitDosName(dosFilename, prefix, rest);
+
+            return join(prefix, rest, buffer, nativeFilename);
+        }
+
+        // Converts a batch of names with a single allocation: the first pass measures the results, the second one writes
+        // them one after another into the arena. The native names point into the arena and live as long as it does.
+        // The optional split(const USimpleString& dosFilename, USimpleString& prefix, USimpleString& rest) routine
+        // replaces splitDosName, e.g. to map drive letters to device names.
+        template<POOL_TYPE poolType>
+        static NTSTATUS dosNamesToNative(span<const USimpleString> dosFilenames, span<USimpleString> nativeFilenames, _Out_ scoped_buffer<WCHAR, poolType>& arena)
+        {
+            return dosNamesToNative(dosFilenames, nativeFilenames, arena, &splitDosName);
+        }
+
+        template<POOL_TYPE poolType, class SplitRoutine>
+        static NTSTATUS dosNamesToNative(span<const USimpleString> dosFilenames, span<USimpleString> nativeFilenames, _Out_ scoped_buffer<WCHAR, poolType>& arena, SplitRoutine&& split)
+        {
+            arena.clear();
+
+            if (nativeFilenames.size() < dosFilenames.size())
+            {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            ULONG64 totalLength = 0;
+
+            for (const auto& dosFilename : dosFilenames)
+            {
+                USimpleString prefix;
+                USimpleString rest;
+                split(dosFilename, prefix, rest);
+
+                const size_t length = static_cast<size_t>(prefix.charLength()) + rest.charLength();
+                if (length > MAXUSHORT / sizeof(WCHAR))
+                {
+                    return STATUS_NAME_TOO_LONG;
+                }
+
+                totalLength += length;
+            }
+
+            if (totalLength > MAXULONG)
+            {
+                return STATUS_INTEGER_OVERFLOW;
+            }
+
+            if (totalLength)
+            {
+                NTSTATUS status = arena.resize(static_cast<ULONG>(totalLength));
+                if (!NT_SUCCESS(status))
+                {
+                    return status;
+                }
+            }
+
+            span<WCHAR> buffer{ totalLength ? arena.get() : nullptr, static_cast<size_t>(totalLength) };
+
+            for (size_t i = 0; i < dosFilenames.size(); ++i)
+            {
+                USimpleString prefix;
+                USimpleString rest;
+                split(dosFilenames[i], prefix, rest);
+
+                NTSTATUS status = join(prefix, rest, buffer, nativeFilenames[i]);
+                if (!NT_SUCCESS(status))
+                {
+                    // The split routine returned longer parts than in the first pass
+                    arena.clear();
+                    return status;
+                }
+
+                buffer = buffer.subspan(nativeFilenames[i].charLength());
+            }
+
+            return STATUS_SUCCESS;
+        }
+
+        // Splits a DOS name into the NT prefix and the rest, dosNameToNative joins them:
+        // "\\\\?\\C:\\dir"         -> "\\??\\", "C:\\dir"
+        // "\\\\server\\share\\dir" -> "\\device\\mup\\", "server\\share\\dir"
+        // "C:\\dir"                -> "\\??\\", "C:\\dir"
+        static void splitDosName(const USimpleString& dosFilename, _Out_ USimpleString& prefix, _Out_ USimpleString& rest)
+        {
+            static constexpr UNICODE_STRING kExtendedPathPrefix = RTL_CONSTANT_STRING(L"\\\\?\\");
+            static constexpr UNICODE_STRING kNtPrefix = RTL_CONSTANT_STRING(L"\\??\\");
+            static constexpr UNICODE_STRING kUncPrefix = RTL_CONSTANT_STRING(L"\\\\");
+            static constexpr UNICODE_STRING kMupPrefix = RTL_CONSTANT_STRING(L"\\device\\mup\\");
 
             if (dosFilename.startsWith(kExtendedPathPrefix))
             {
-                nativeFilename.append(kNtPrefix, dosFilename.substring(kExtendedPathPrefix.Length / sizeof(WCHAR)));
+                prefix.setString(kNtPrefix);
+                rest = dosFilename.substring(kExtendedPathPrefix.Length / sizeof(WCHAR));
             }
             else if (dosFilename.startsWith(kUncPrefix))
             {
-                nativeFilename.append(L"\\device\\mup\\", dosFilename.substring(kUncPrefix.Length / sizeof(WCHAR)));
+                prefix.setString(kMupPrefix);
+                rest = dosFilename.substring(kUncPrefix.Length / sizeof(WCHAR));
             }
             else
             {
-                nativeFilename.append(kNtPrefix, dosFilename);
+                prefix.setString(kNtPrefix);
+                rest.setString(dosFilename);
             }
-
-            return std::move(nativeFilename.string());
         }
 
         static bool isAbsoluteRegistryPath(const USimpleString& path)
@@ -155,6 +272,23 @@ namespace kf
             return path.startsWithIgnoreCase(L"\\REGISTRY\\");
         }
 
+    private:
+        static NTSTATUS join(const USimpleString& prefix, const USimpleString& rest, span<WCHAR> buffer, _Out_ USimpleString& result)
+        {
+            const size_t length = static_cast<size_t>(prefix.charLength()) + rest.charLength();
+            if (length > buffer.size() || length > MAXUSHORT / sizeof(WCHAR))
+            {
+                result = USimpleString();
+                return STATUS_BUFFER_TOO_SMALL;
+            }
+
+            RtlCopyMemory(buffer.data(), prefix.buffer(), prefix.byteLength());
+            RtlCopyMemory(buffer.data() + prefix.charLength(), rest.buffer(), rest.byteLength());
+
+            result = USimpleString(buffer.first(length));
+            return STATUS_SUCCESS;
+        }
+
     private:
         FilenameUtils();
     };
@@ -0,0 +1,185 @@
+#pragma once
+#include "FlatMessageFormat.h"
+#include "USimpleString.h"
+#include "ASimpleString.h"
+#include "SpanUtils.h"
+
+namespace kf
+{
+    using namespace std;
+
+    //////////////////////////////////////////////////////////////////////////
+    // FlatMessage - flat offset-based message format for port messages, see FlatMessageFormat.h for the layout.
+    // The service includes FlatMessageFormat.h only, this header adds the builder and NT string views for the driver.
+    // Strings are stored as UTF-16 for USimpleString and bytes for ASimpleString.
+    /*
+    enum { kFileName, kProcessId, kFieldCount };
+
+    FlatMessageBuilder builder(as_writable_bytes(outputBuffer, outputBufferLength), kFieldCount);
+    builder.addString(kFileName, fileName);
+    builder.add(kProcessId, processId);
+    status = builder.finish(*returnOutputBufferLength);
+
+    FlatMessageReader<kFieldCount> reader;
+    status = reader.attach(as_bytes(inputBuffer, inputBufferLength));
+    USimpleString fileName = reader.getUString(kFileName);
+    */
+
+    //////////////////////////////////////////////////////////////////////////
+    // FlatMessageBuilder - writes a message in place, e.g. directly into the output buffer of onMessage
+
+    class FlatMessageBuilder
+    {
+    public:
+        // The usable size is rounded down to 8 bytes, so every field starts at an aligned offset
+        FlatMessageBuilder(span<std::byte> buffer, UINT16 fieldCount) : m_buffer(buffer.first(min<size_t>(buffer.size(), MAXUINT32) & ~size_t(7))), m_fieldCount(fieldCount)
+        {
+            m_used = flatMessageAlign(sizeof(FlatMessageHeader) + sizeof(FlatMessageField) * fieldCount);
+
+            if (m_used > m_buffer.size())
+            {
+                m_status = STATUS_BUFFER_TOO_SMALL;
+                return;
+            }
+
+            RtlZeroMemory(m_buffer.data(), m_used);
+        }
+
+        FlatMessageBuilder(const FlatMessageBuilder&) = delete;
+        FlatMessageBuilder& operator=(const FlatMessageBuilder&) = delete;
+
+        // Returns space for the field in the message to be filled by the caller, or an empty span on failure
+        span<std::byte> reserve(UINT16 field, size_t size)
+        {
+            if (!NT_SUCCESS(m_status))
+            {
+                return {};
+            }
+
+            if (field >= m_fieldCount || fields()[field].offset)
+            {
+                m_status = STATUS_INVALID_PARAMETER;
+                return {};
+            }
+
+            if (size > m_buffer.size() - m_used)
+            {
+                m_status = STATUS_BUFFER_TOO_SMALL;
+                return {};
+            }
+
+            auto& entry = fields()[field];
+            entry.offset = static_cast<UINT32>(m_used);
+            entry.size = static_cast<UINT32>(size);
+
+            auto data = m_buffer.subspan(m_used, size);
+
+            // The padding is zeroed so nothing stale from the buffer is sent. The buffer size is a multiple of 8, so
+            // m_used stays aligned.
+            const size_t next = flatMessageAlign(m_used + size);
+            RtlZeroMemory(m_buffer.data() + m_used + size, next - m_used - size);
+            m_used = next;
+
+            return data;
+        }
+
+        NTSTATUS addBytes(UINT16 field, span<const std::byte> data)
+        {
+            auto destination = reserve(field, data.size());
+            if (destination.size() != data.size())
+            {
+                return m_status;
+            }
+
+            RtlCopyMemory(destination.data(), data.data(), data.size());
+            return STATUS_SUCCESS;
+        }
+
+        template<class T>
+        NTSTATUS add(UINT16 field, const T& value) requires is_trivially_copyable_v<T>
+        {
+            return addBytes(field, { reinterpret_cast<const std::byte*>(&value), sizeof(T) });
+        }
+
+        NTSTATUS addString(UINT16 field, const USimpleString& str)
+        {
+            return addBytes(field, { reinterpret_cast<const std::byte*>(str.buffer()), static_cast<size_t>(str.byteLength()) });
+        }
+
+        NTSTATUS addString(UINT16 field, const ASimpleString& str)
+        {
+            return addBytes(field, { reinterpret_cast<const std::byte*>(str.string().Buffer), static_cast<size_t>(str.byteLength()) });
+        }
+
+        // Returns the first error of the add calls if any
+        NTSTATUS finish(_Out_ ULONG& size)
+        {
+            size = 0;
+
+            if (!NT_SUCCESS(m_status))
+            {
+                return m_status;
+            }
+
+            auto header = reinterpret_cast<FlatMessageHeader*>(m_buffer.data());
+            header->size = static_cast<UINT32>(m_used);
+            header->fieldCount = m_fieldCount;
+            header->reserved = 0;
+
+            size = static_cast<ULONG>(m_used);
+            return STATUS_SUCCESS;
+        }
+
+    private:
+        FlatMessageField* fields()
+        {
+            return reinterpret_cast<FlatMessageField*>(m_buffer.data() + sizeof(FlatMessageHeader));
+        }
+
+    private:
+        span<std::byte> m_buffer;
+        size_t          m_used = 0;
+        UINT16          m_fieldCount;
+        NTSTATUS        m_status = STATUS_SUCCESS;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // FlatMessageReader - FlatMessageView with NTSTATUS results and NT string views
+
+    template<int kMaxFields = 32>
+    class FlatMessageReader : public FlatMessageView<kMaxFields>
+    {
+    public:
+        FlatMessageReader() = default;
+
+        NTSTATUS attach(span<const std::byte> message)
+        {
+            return FlatMessageView<kMaxFields>::attach(message) ? STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+        }
+
+        // Empty string for an absent field or a field too long for UNICODE_STRING,
+        // a trailing odd byte is not a part of the string
+        USimpleString getUString(UINT16 field) const
+        {
+            auto data = this->getUtf16(field);
+            if (data.size_bytes() > MAXUSHORT)
+            {
+                return USimpleString();
+            }
+
+            return USimpleString(data.data(), static_cast<int>(data.size_bytes()));
+        }
+
+        // Empty string for an absent field or a field too long for ANSI_STRING
+        ASimpleString getAString(UINT16 field) const
+        {
+            auto data = this->getChars(field);
+            if (data.size() > MAXUSHORT)
+            {
+                return ASimpleString();
+            }
+
+            return ASimpleString(data);
+        }
+    };
+}
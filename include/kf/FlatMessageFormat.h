@@ -0,0 +1,161 @@
+#pragma once
+#include <span>
+#include <type_traits>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace kf
+{
+    using namespace std;
+
+    //////////////////////////////////////////////////////////////////////////
+    // FlatMessageFormat - wire format of FlatMessage and a reader for it. This header has no kernel dependencies so
+    // the user-mode service can include it too, FlatMessage.h adds the builder and NT string views for the driver.
+    //
+    // Layout: FlatMessageHeader, then a table of fieldCount FlatMessageField entries indexed by field id, then the data
+    // area. Every field is a blob at an 8-byte aligned offset from the start of the message, an absent field has
+    // offset 0. Strings are stored without a terminator: UTF-16 code units or bytes.
+    // Field ids and their types are a convention between the driver and the service, like the order of struct members.
+
+    struct FlatMessageHeader
+    {
+        // Size of the whole message including this header
+        uint32_t size;
+        uint16_t fieldCount;
+        uint16_t reserved;
+    };
+
+    struct FlatMessageField
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    inline constexpr size_t flatMessageAlign(size_t size)
+    {
+        return (size + 7) & ~size_t(7);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // FlatMessageView - validates a message in a single pass and returns views into it without copying.
+    //
+    // The field table is copied during validation, so a client changing the buffer afterwards (it can be mapped from
+    // user space) can not move a field outside the message. Field data is not copied and can still change under views.
+    // Fields above kMaxFields are ignored, so newer senders can add fields.
+
+    template<int kMaxFields = 32>
+    class FlatMessageView
+    {
+    public:
+        FlatMessageView() = default;
+
+        FlatMessageView(const FlatMessageView&) = delete;
+        FlatMessageView& operator=(const FlatMessageView&) = delete;
+
+        // Returns false if the message is not valid
+        bool attach(span<const std::byte> message)
+        {
+            m_message = {};
+            m_fieldCount = 0;
+
+            if (message.size() < sizeof(FlatMessageHeader))
+            {
+                return false;
+            }
+
+            FlatMessageHeader header;
+            memcpy(&header, message.data(), sizeof(header));
+
+            const size_t tableEnd = sizeof(FlatMessageHeader) + sizeof(FlatMessageField) * header.fieldCount;
+            if (header.size > message.size() || tableEnd > header.size)
+            {
+                return false;
+            }
+
+            const int fieldCount = min(static_cast<int>(header.fieldCount), kMaxFields);
+            memcpy(m_fields, message.data() + sizeof(FlatMessageHeader), sizeof(FlatMessageField) * fieldCount);
+
+            for (int i = 0; i < fieldCount; ++i)
+            {
+                const auto& field = m_fields[i];
+
+                if (!field.offset)
+                {
+                    if (field.size)
+                    {
+                        return false;
+                    }
+
+                    continue;
+                }
+
+                // Strings are viewed in place, so a field must keep the alignment the builder gave it
+                if ((field.offset & 7) || field.offset < tableEnd || field.offset > header.size || field.size > header.size - field.offset)
+                {
+                    return false;
+                }
+            }
+
+            m_message = message.first(header.size);
+            m_fieldCount = fieldCount;
+
+            return true;
+        }
+
+        bool has(uint16_t field) const
+        {
+            return field < m_fieldCount && m_fields[field].offset;
+        }
+
+        // Empty span for an absent field
+        span<const std::byte> getBytes(uint16_t field) const
+        {
+            if (!has(field))
+            {
+                return {};
+            }
+
+            return m_message.subspan(m_fields[field].offset, m_fields[field].size);
+        }
+
+        // Returns false if the field is absent or has a different size, the value is copied as the message
+        // may be unaligned
+        template<class T>
+        bool get(uint16_t field, T& value) const requires is_trivially_copyable_v<T>
+        {
+            auto data = getBytes(field);
+            if (data.size() != sizeof(T))
+            {
+                return false;
+            }
+
+            memcpy(&value, data.data(), sizeof(T));
+            return true;
+        }
+
+        // UTF-16 code units, a trailing odd byte is not a part of the string. Empty for an absent field or a message
+        // that does not start at an even address.
+        span<const char16_t> getUtf16(uint16_t field) const
+        {
+            auto data = getBytes(field);
+            if (reinterpret_cast<uintptr_t>(data.data()) & 1)
+            {
+                return {};
+            }
+
+            return { reinterpret_cast<const char16_t*>(data.data()), data.size() / sizeof(char16_t) };
+        }
+
+        span<const char> getChars(uint16_t field) const
+        {
+            auto data = getBytes(field);
+            return { reinterpret_cast<const char*>(data.data()), data.size() };
+        }
+
+    private:
+        span<const std::byte>   m_message;
+        FlatMessageField        m_fields[kMaxFields] = {};
+        int                     m_fieldCount = 0;
+    };
+}
@@ -197,6 +197,26 @@ namespace kf
         {
             auto handler = static_cast<Handler*>(connectionCookie);
 
+            //
+            // Buffers registered in the handler's FltMessageBufferCache are already locked and mapped
+            //
+
+            PVOID cachedInputBuffer = nullptr;
+            PVOID cachedOutputBuffer = nullptr;
+
+            if constexpr (requires { handler->messageBufferCache(); })
+            {
+                if (inputBufferLength)
+                {
+                    cachedInputBuffer = handler->messageBufferCache().lookup(inputBuffer, inputBufferLength, false);
+                }
+
+                if (outputBufferLength)
+                {
+                    cachedOutputBuffer = handler->messageBufferCache().lookup(outputBuffer, outputBufferLength, true);
+                }
+            }
+
             PMDL inputMdl = nullptr;
             PMDL outputMdl = nullptr;
 
@@ -212,7 +232,11 @@ namespace kf
 
                 __try
                 {
-                    if (inputBufferLength)
+                    if (cachedInputBuffer)
+                    {
+                        inputBuffer = cachedInputBuffer;
+                    }
+                    else if (inputBufferLength)
                     {
                         inputMdl = IoAllocateMdl(inputBuffer, inputBufferLength, false, false, nullptr);
                         if (!inputMdl)
@@ -229,7 +253,11 @@ namespace kf
                         }
                     }
 
-                    if (outputBufferLength)
+                    if (cachedOutputBuffer)
+                    {
+                        outputBuffer = cachedOutputBuffer;
+                    }
+                    else if (outputBufferLength)
                     {
                         outputMdl = IoAllocateMdl(outputBuffer, outputBufferLength, false, false, nullptr);
                         if (!outputMdl)
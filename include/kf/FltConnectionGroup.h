@@ -0,0 +1,188 @@
+#pragma once
+#include "FltMessagePump.h"
+
+namespace kf
+{
+    //////////////////////////////////////////////////////////////////////////
+    // FltConnectionGroup - spreads driver-to-service events over all clients connected to a FltCommunicationPort,
+    // e.g. several scanner processes working in parallel.
+    //
+    // Every connection handler owns a started FltMessagePump and adds it to the group in onConnect. submit() picks
+    // a connection by the balancing policy and falls back to the other connections if the chosen queue is full.
+    // remove() in onDisconnect stops the pump and moves its outstanding events to the remaining connections.
+    /*
+    NTSTATUS SampleHandler::onConnect(PFLT_FILTER filter, PFLT_PORT clientPort, ...)
+    {
+        ...
+        status = handler->m_pump.start(filter, clientPort);
+        ...
+        return s_group.add(handler->m_pump);
+    }
+
+    void SampleHandler::onDisconnect()
+    {
+        s_group.remove(m_pump);
+        delete this;
+    }
+    */
+
+    template<class Pump = FltMessagePump<>, int kMaxConnections = 16>
+    class FltConnectionGroup
+    {
+    public:
+        enum class Balancing
+        {
+            // The connection with the fewest queued and in-flight events
+            LeastOutstanding,
+            RoundRobin
+        };
+
+        FltConnectionGroup(Balancing balancing = Balancing::LeastOutstanding) : m_balancing(balancing)
+        {
+        }
+
+        ~FltConnectionGroup()
+        {
+            ASSERT(!m_count);
+        }
+
+        FltConnectionGroup(const FltConnectionGroup&) = delete;
+        FltConnectionGroup& operator=(const FltConnectionGroup&) = delete;
+
+        NTSTATUS add(Pump& pump)
+        {
+            AutoSpinLock lock(m_lock);
+
+            if (m_count == kMaxConnections)
+            {
+                return STATUS_TOO_MANY_SESSIONS;
+            }
+
+            m_connections[m_count++] = &pump;
+
+            return STATUS_SUCCESS;
+        }
+
+        // Must be called at PASSIVE_LEVEL, events that can not be moved are completed with STATUS_CANCELLED
+        void remove(Pump& pump)
+        {
+            ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+            {
+                AutoSpinLock lock(m_lock);
+
+                for (int i = 0; i < m_count; ++i)
+                {
+                    if (m_connections[i] == &pump)
+                    {
+                        m_connections[i] = m_connections[--m_count];
+                        m_connections[m_count] = nullptr;
+                        break;
+                    }
+                }
+            }
+
+            pump.stop(&reroute, this);
+        }
+
+        // Can be called at IRQL <= DISPATCH_LEVEL
+        NTSTATUS submit(span<const std::byte> data, typename Pump::CompletionRoutine completion, _In_opt_ PVOID context)
+        {
+            // The event is built once outside the lock, under the lock a connection only links it into its queue
+            typename Pump::Request* request;
+            NTSTATUS status = Pump::allocateRequest(data, completion, context, &request);
+            if (!NT_SUCCESS(status))
+            {
+                return status;
+            }
+
+            status = STATUS_PORT_DISCONNECTED;
+            {
+                AutoSpinLock lock(m_lock);
+
+                const int first = m_count ? select() : 0;
+
+                for (int i = 0; i < m_count; ++i)
+                {
+                    status = m_connections[(first + i) % m_count]->submit(*request);
+                    if (status != STATUS_DEVICE_BUSY && status != STATUS_PORT_DISCONNECTED)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            // A pump that accepted the event may have completed and freed it already
+            if (!NT_SUCCESS(status))
+            {
+                Pump::freeRequest(*request);
+            }
+
+            return status;
+        }
+
+        int connectionCount() const
+        {
+            return m_count;
+        }
+
+        // Calls routine(Pump&, ULONG queueDepth, ULONG outstanding) for every connection at DISPATCH_LEVEL
+        template<class F>
+        void forEachConnection(F&& routine)
+        {
+            AutoSpinLock lock(m_lock);
+
+            for (int i = 0; i < m_count; ++i)
+            {
+                routine(*m_connections[i], m_connections[i]->queueDepth(), m_connections[i]->outstanding());
+            }
+        }
+
+    private:
+        // Must be called under the lock with m_count > 0
+        int select()
+        {
+            if (m_balancing == Balancing::RoundRobin)
+            {
+                return m_next++ % m_count;
+            }
+
+            int best = 0;
+            ULONG bestOutstanding = m_connections[0]->outstanding();
+
+            for (int i = 1; i < m_count && bestOutstanding; ++i)
+            {
+                const ULONG outstanding = m_connections[i]->outstanding();
+                if (outstanding < bestOutstanding)
+                {
+                    best = i;
+                    bestOutstanding = outstanding;
+                }
+            }
+
+            return best;
+        }
+
+        // The target is chosen and takes the event under the lock, so it can not be removed and destroyed meanwhile
+        static bool reroute(typename Pump::Request& request, PVOID context)
+        {
+            auto self = static_cast<FltConnectionGroup*>(context);
+
+            AutoSpinLock lock(self->m_lock);
+
+            if (!self->m_count)
+            {
+                return false;
+            }
+
+            return NT_SUCCESS(self->m_connections[self->select()]->transfer(request));
+        }
+
+    private:
+        SpinLock    m_lock;
+        Pump*       m_connections[kMaxConnections] = {};
+        int         m_count = 0;
+        unsigned    m_next = 0;
+        Balancing   m_balancing;
+    };
+}
@@ -0,0 +1,194 @@
+#pragma once
+#include <atomic>
+#include "Guard.h"
+
+namespace kf
+{
+    //////////////////////////////////////////////////////////////////////////
+    // FltMessageBufferCache - per-connection cache of locked and mapped client buffers for FltCommunicationPort.
+    //
+    // The client registers its message buffers once (the handler calls registerBuffer from onMessage, which runs in the
+    // client process), and promises to keep them allocated until it disconnects. After that FltCommunicationPort
+    // uses the cached system addresses for every message whose buffer lies inside a registered one, instead of
+    // allocating, probing, locking and mapping MDLs per message. The handler exposes the cache by a
+    // messageBufferCache() method and calls clear() from onDisconnect.
+    /*
+    class SampleHandler
+    {
+    public:
+        FltMessageBufferCache<>& messageBufferCache()
+        {
+            return m_bufferCache;
+        }
+
+        void onDisconnect()
+        {
+            m_bufferCache.clear();
+            delete this;
+        }
+        ...
+    };
+    */
+
+    template<int kMaxBuffers = 8>
+    class FltMessageBufferCache
+    {
+    public:
+        FltMessageBufferCache()
+        {
+        }
+
+        ~FltMessageBufferCache()
+        {
+            clear();
+        }
+
+        FltMessageBufferCache(const FltMessageBufferCache&) = delete;
+        FltMessageBufferCache& operator=(const FltMessageBufferCache&) = delete;
+
+        // Must be called in the context of the client process, registrations must not run concurrently with each other
+        NTSTATUS registerBuffer(PVOID userBuffer, ULONG length, LOCK_OPERATION operation)
+        {
+            ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
+
+            if (!userBuffer || !length)
+            {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            if (!m_process)
+            {
+                ObReferenceObject(PsGetCurrentProcess());
+                m_process.reset(PsGetCurrentProcess());
+
+                // lookup() runs concurrently and reads only the published pointer
+                m_owner.store(PsGetCurrentProcess(), std::memory_order_release);
+            }
+            else if (m_process != PsGetCurrentProcess())
+            {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            const int index = m_reserved.fetch_add(1);
+            if (index >= kMaxBuffers)
+            {
+                m_reserved.fetch_sub(1);
+                return STATUS_QUOTA_EXCEEDED;
+            }
+
+            auto& entry = m_entries[index];
+
+            entry.systemAddress = lockAndMap(userBuffer, length, operation, entry.mdl);
+            if (!entry.systemAddress)
+            {
+                // The slot stays unused until clear()
+                return STATUS_INVALID_USER_BUFFER;
+            }
+
+            entry.userAddress = static_cast<std::byte*>(userBuffer);
+            entry.length = length;
+            entry.writable = operation != IoReadAccess;
+            entry.valid.store(true, std::memory_order_release);
+
+            return STATUS_SUCCESS;
+        }
+
+        // Returns the system address for the user buffer if it lies inside a registered one, nullptr otherwise
+        PVOID lookup(PVOID userBuffer, ULONG length, bool write) const
+        {
+            const PEPROCESS owner = m_owner.load(std::memory_order_acquire);
+            if (!owner || owner != PsGetCurrentProcess())
+            {
+                return nullptr;
+            }
+
+            const auto begin = static_cast<std::byte*>(userBuffer);
+
+            for (const auto& entry : m_entries)
+            {
+                if (!entry.valid.load(std::memory_order_acquire) || (write && !entry.writable))
+                {
+                    continue;
+                }
+
+                // The offset is compared in full width, a buffer 4 GB past a registered one must not match it
+                if (begin >= entry.userAddress && length <= entry.length && static_cast<size_t>(begin - entry.userAddress) <= entry.length - length)
+                {
+                    return entry.systemAddress + (begin - entry.userAddress);
+                }
+            }
+
+            return nullptr;
+        }
+
+        // No messages may be in flight, call it from onDisconnect
+        void clear()
+        {
+            for (auto& entry : m_entries)
+            {
+                if (entry.mdl)
+                {
+                    if (FlagOn(entry.mdl->MdlFlags, MDL_PAGES_LOCKED))
+                    {
+                        MmUnlockPages(entry.mdl);
+                    }
+
+                    IoFreeMdl(entry.mdl);
+                }
+
+                entry.valid.store(false, std::memory_order_relaxed);
+                entry.mdl = nullptr;
+                entry.systemAddress = nullptr;
+                entry.userAddress = nullptr;
+                entry.length = 0;
+            }
+
+            m_reserved = 0;
+            m_owner.store(nullptr, std::memory_order_relaxed);
+            m_process.reset();
+        }
+
+    private:
+        static std::byte* lockAndMap(PVOID userBuffer, ULONG length, LOCK_OPERATION operation, _Out_ PMDL& mdl)
+        {
+            //
+            // ATTENTION: Destructors are not called in this function due to __try/__except!
+            //
+
+            mdl = IoAllocateMdl(userBuffer, length, false, false, nullptr);
+            if (!mdl)
+            {
+                return nullptr;
+            }
+
+            __try
+            {
+                MmProbeAndLockPages(mdl, UserMode, operation);
+            }
+            __except (EXCEPTION_EXECUTE_HANDLER)
+            {
+                return nullptr;
+            }
+
+            const ULONG priority = NormalPagePriority | MdlMappingNoExecute | (operation == IoReadAccess ? MdlMappingNoWrite : 0);
+            return static_cast<std::byte*>(MmGetSystemAddressForMdlSafe(mdl, priority));
+        }
+
+    private:
+        struct Entry
+        {
+            std::byte*          userAddress = nullptr;
+            std::byte*          systemAddress = nullptr;
+            ULONG               length = 0;
+            bool                writable = false;
+            PMDL                mdl = nullptr;
+            std::atomic<bool>   valid = false;
+        };
+
+        Entry               m_entries[kMaxBuffers];
+        std::atomic<int>    m_reserved = 0;
+        Guard::EProcess     m_process;
+        // The same process as m_process, set once before any entry becomes valid
+        std::atomic<PEPROCESS> m_owner = nullptr;
+    };
+}
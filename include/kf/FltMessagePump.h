@@ -0,0 +1,523 @@
+#pragma once
+#include <atomic>
+#include <span>
+#include "FltMessagePumpProtocol.h"
+#include "DoubleLinkedList.h"
+#include "SpinLock.h"
+#include "AutoSpinLock.h"
+#include "Event.h"
+#include "ThreadPool.h"
+#include "ScopedBuffer.h"
+
+namespace kf
+{
+    using namespace std;
+
+    //////////////////////////////////////////////////////////////////////////
+    // FltMessagePump - asynchronous driver-to-service messages over a FltCommunicationPort client port.
+    //
+    // submit() copies the event into a bounded queue and returns immediately, so the I/O path never waits for the
+    // service. Sender threads take several queued events at once, pack them into one message (see
+    // FltMessagePumpProtocol.h), call FltSendMessage and match the replies to the events by event ID. Every accepted
+    // event gets exactly one call of its completion routine: with the service reply, STATUS_TIMEOUT if the service
+    // did not answer in time, STATUS_NOT_FOUND if the reply had no entry for the event, STATUS_CANCELLED on stop() or
+    // the FltSendMessage failure status. Completion routines run on a sender thread at PASSIVE_LEVEL.
+    //
+    // A handler typically owns a pump for its client port, starts it in onConnect and stops it in onDisconnect
+    // before closing the port.
+
+    template<POOL_TYPE poolType = NonPagedPoolNx, int kMaxThreads = 8>
+    class FltMessagePump
+    {
+    public:
+        typedef void (*CompletionRoutine)(NTSTATUS status, span<const std::byte> reply, PVOID context);
+
+        // Queued event, opaque to the users of the pump
+        struct Request
+        {
+            DoubleLinkedListEntry m_entry;
+            ULONG64               m_id = 0;
+            CompletionRoutine     m_completion = nullptr;
+            PVOID                 m_context = nullptr;
+            ULONG                 m_size = 0;
+
+            std::byte* data()
+            {
+                return reinterpret_cast<std::byte*>(this + 1);
+            }
+        };
+
+        // Called for every event of a stopping pump, returns true if the event was passed to another pump by transfer()
+        typedef bool (*RerouteRoutine)(Request& request, PVOID context);
+
+        struct Config
+        {
+            // Events queued and not yet sent, submit() fails with STATUS_DEVICE_BUSY above it
+            ULONG maxQueued = 1024;
+            int threadCount = 2;
+            ULONG maxBatchEvents = 16;
+            ULONG maxMessageSize = 64 * 1024;
+            ULONG maxReplySize = 16 * 1024;
+            // Relative timeout for a single FltSendMessage in milliseconds
+            ULONG timeoutMs = 5000;
+        };
+
+        FltMessagePump(const Config& config = Config()) : m_config(config), m_threads(config.threadCount), m_wakeEvent(SynchronizationEvent, false)
+        {
+        }
+
+        ~FltMessagePump()
+        {
+            stop();
+        }
+
+        FltMessagePump(const FltMessagePump&) = delete;
+        FltMessagePump& operator=(const FltMessagePump&) = delete;
+
+        NTSTATUS start(PFLT_FILTER filter, PFLT_PORT clientPort)
+        {
+            ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+            ASSERT(!m_started);
+
+            if (m_config.maxMessageSize < sizeof(FltPumpMessageHeader) + sizeof(FltPumpEventHeader) || m_config.maxReplySize < sizeof(FltPumpReplyHeader) || !m_config.maxBatchEvents)
+            {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            m_filter = filter;
+            m_clientPort = clientPort;
+            m_stopping = false;
+            m_started = true;
+
+            NTSTATUS status = m_threads.template start<&FltMessagePump::senderRoutine>(this);
+            if (!NT_SUCCESS(status))
+            {
+                stop();
+                return status;
+            }
+
+            return STATUS_SUCCESS;
+        }
+
+        // Waits for the senders and completes all queued events with STATUS_CANCELLED
+        void stop()
+        {
+            stop(nullptr, nullptr);
+        }
+
+        // Waits for the senders and offers queued events, and events whose FltSendMessage fails from now on, to reroute.
+        // Events it does not take are completed with STATUS_CANCELLED or the send failure status. Events that are
+        // rerouted after a failed send may have reached the service already.
+        void stop(_In_opt_ RerouteRoutine reroute, _In_opt_ PVOID rerouteContext)
+        {
+            ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+            if (!m_started)
+            {
+                return;
+            }
+
+            m_reroute = reroute;
+            m_rerouteContext = rerouteContext;
+
+            m_stopping = true;
+            m_wakeEvent.set();
+            m_threads.join();
+
+            RequestList pending;
+            {
+                AutoSpinLock lock(m_lock);
+                pending = m_queue.takeAll();
+                m_queued = 0;
+            }
+
+            transferAll(pending, STATUS_CANCELLED);
+
+            m_reroute = nullptr;
+            m_rerouteContext = nullptr;
+            m_started = false;
+        }
+
+        // Can be called at IRQL <= DISPATCH_LEVEL, the data is copied. The completion routine is not called
+        // if the event is not accepted.
+        NTSTATUS submit(span<const std::byte> data, CompletionRoutine completion, _In_opt_ PVOID context)
+        {
+            if (!fits(data.size()))
+            {
+                return STATUS_INVALID_BUFFER_SIZE;
+            }
+
+            if (m_stopping || !m_started)
+            {
+                return STATUS_PORT_DISCONNECTED;
+            }
+
+            Request* request;
+            NTSTATUS status = allocateRequest(data, completion, context, &request);
+            if (!NT_SUCCESS(status))
+            {
+                return status;
+            }
+
+            status = enqueue(request, false);
+            if (!NT_SUCCESS(status))
+            {
+                free(request);
+                return status;
+            }
+
+            return STATUS_SUCCESS;
+        }
+
+        // Queues an event built by allocateRequest(), e.g. to copy the data once and offer it to several pumps.
+        // The pump owns the event on success, otherwise the caller keeps it and frees it with freeRequest().
+        NTSTATUS submit(Request& request)
+        {
+            if (!fits(request.m_size))
+            {
+                return STATUS_INVALID_BUFFER_SIZE;
+            }
+
+            return enqueue(&request, false);
+        }
+
+        // Can be called at IRQL <= DISPATCH_LEVEL, the data is copied
+        static NTSTATUS allocateRequest(span<const std::byte> data, CompletionRoutine completion, _In_opt_ PVOID context, _Out_ Request** request)
+        {
+            *request = nullptr;
+
+            if (data.size() > MAXULONG - sizeof(Request))
+            {
+                return STATUS_INVALID_BUFFER_SIZE;
+            }
+
+            auto buffer = new(poolType) std::byte[sizeof(Request) + data.size()];
+            if (!buffer)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            auto newRequest = new(buffer) Request();
+            newRequest->m_id = s_nextId.fetch_add(1, memory_order_relaxed);
+            newRequest->m_completion = completion;
+            newRequest->m_context = context;
+            newRequest->m_size = static_cast<ULONG>(data.size());
+            RtlCopyMemory(newRequest->data(), data.data(), data.size());
+
+            *request = newRequest;
+            return STATUS_SUCCESS;
+        }
+
+        // Frees an event that no pump has accepted, its completion routine is not called
+        static void freeRequest(Request& request)
+        {
+            free(&request);
+        }
+
+        // Events accepted by submit() and not yet taken by a sender
+        ULONG queueDepth() const
+        {
+            return m_queued;
+        }
+
+        // Queued events plus events being sent
+        ULONG outstanding() const
+        {
+            return m_queued + m_inFlight.load(memory_order_relaxed);
+        }
+
+        // Takes over an event of another pump, see stop(RerouteRoutine, PVOID)
+        NTSTATUS transfer(Request& request)
+        {
+            return enqueue(&request, true);
+        }
+
+    private:
+        typedef DoubleLinkedList<Request, &Request::m_entry> RequestList;
+
+        static void free(Request* request)
+        {
+            request->~Request();
+            delete[] reinterpret_cast<std::byte*>(request);
+        }
+
+        static void complete(Request* request, NTSTATUS status, span<const std::byte> reply)
+        {
+            if (request->m_completion)
+            {
+                request->m_completion(status, reply, request->m_context);
+            }
+
+            free(request);
+        }
+
+        static void completeAll(RequestList& batch, NTSTATUS status)
+        {
+            while (auto request = batch.removeFirst())
+            {
+                complete(request, status, {});
+            }
+        }
+
+        // Uses the padded record size takeBatch() packs, so an accepted event always fits into an empty message even if
+        // maxMessageSize is not a multiple of 8
+        bool fits(size_t size) const
+        {
+            return size <= m_config.maxMessageSize && sizeof(FltPumpMessageHeader) + fltPumpRecordSize<FltPumpEventHeader>(static_cast<ULONG>(size)) <= m_config.maxMessageSize;
+        }
+
+        // Rerouted events are accepted above maxQueued so they are not lost
+        NTSTATUS enqueue(Request* request, bool rerouted)
+        {
+            bool wake = false;
+            {
+                AutoSpinLock lock(m_lock);
+
+                // Checked under the lock, so nothing is queued after stop() has taken the queue
+                if (m_stopping || !m_started || !fits(request->m_size))
+                {
+                    return STATUS_PORT_DISCONNECTED;
+                }
+
+                if (!rerouted && m_queued >= m_config.maxQueued)
+                {
+                    return STATUS_DEVICE_BUSY;
+                }
+
+                wake = m_queue.isEmpty();
+                m_queue.addLast(*request);
+                ++m_queued;
+            }
+
+            if (wake)
+            {
+                m_wakeEvent.set();
+            }
+
+            return STATUS_SUCCESS;
+        }
+
+        // Offers the events to m_reroute and completes the ones it does not take with the status
+        void transferAll(RequestList& requests, NTSTATUS status)
+        {
+            while (auto request = requests.removeFirst())
+            {
+                if (!m_reroute || !m_reroute(*request, m_rerouteContext))
+                {
+                    complete(request, status, {});
+                }
+            }
+        }
+
+        NTSTATUS senderRoutine()
+        {
+            scoped_buffer<std::byte, poolType> message;
+            scoped_buffer<std::byte, poolType> reply;
+
+            NTSTATUS status = message.resize(m_config.maxMessageSize);
+            if (NT_SUCCESS(status))
+            {
+                status = reply.resize(m_config.maxReplySize);
+            }
+
+            if (!NT_SUCCESS(status))
+            {
+                // Other senders keep working, the last one to leave on stop() passes the wake-up on
+                m_wakeEvent.set();
+                return status;
+            }
+
+            for (;;)
+            {
+                m_wakeEvent.wait();
+
+                if (m_stopping)
+                {
+                    // Auto-reset event wakes a single thread, pass it on to the next sender
+                    m_wakeEvent.set();
+                    return STATUS_SUCCESS;
+                }
+
+                for (;;)
+                {
+                    RequestList batch;
+                    const ULONG messageSize = takeBatch(batch, message.get());
+                    if (!messageSize)
+                    {
+                        break;
+                    }
+
+                    send(batch, message.get(), messageSize, reply.get());
+                    m_inFlight.fetch_sub(reinterpret_cast<const FltPumpMessageHeader*>(message.get())->eventCount, memory_order_relaxed);
+
+                    if (m_stopping)
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Moves up to maxBatchEvents queued events that fit into maxMessageSize to the batch and packs them
+        // into the message, returns the message size or 0 if the queue is empty
+        ULONG takeBatch(RequestList& batch, std::byte* message)
+        {
+            ULONG size = sizeof(FltPumpMessageHeader);
+            ULONG count = 0;
+            bool more = false;
+
+            {
+                AutoSpinLock lock(m_lock);
+
+                for (auto it = m_queue.iterator(); it.hasNext() && count < m_config.maxBatchEvents;)
+                {
+                    auto request = it.next();
+
+                    const ULONG recordSize = fltPumpRecordSize<FltPumpEventHeader>(request->m_size);
+                    if (size + recordSize > m_config.maxMessageSize)
+                    {
+                        break;
+                    }
+
+                    it.remove();
+                    batch.addLast(*request);
+
+                    size += recordSize;
+                    ++count;
+                }
+
+                m_queued -= count;
+                m_inFlight.fetch_add(count, memory_order_relaxed);
+                more = !m_queue.isEmpty();
+            }
+
+            if (!count)
+            {
+                return 0;
+            }
+
+            // Let another sender pick up the rest while this one waits for the reply
+            if (more)
+            {
+                m_wakeEvent.set();
+            }
+
+            auto header = reinterpret_cast<FltPumpMessageHeader*>(message);
+            header->messageId = s_nextId.fetch_add(1, memory_order_relaxed);
+            header->eventCount = count;
+            header->size = size;
+
+            ULONG offset = sizeof(FltPumpMessageHeader);
+            for (auto it = batch.iterator(); it.hasNext();)
+            {
+                auto request = it.next();
+
+                auto eventHeader = reinterpret_cast<FltPumpEventHeader*>(message + offset);
+                eventHeader->eventId = request->m_id;
+                eventHeader->size = request->m_size;
+                eventHeader->reserved = 0;
+                RtlCopyMemory(eventHeader + 1, request->data(), request->m_size);
+
+                offset += fltPumpRecordSize<FltPumpEventHeader>(request->m_size);
+            }
+
+            return size;
+        }
+
+        void send(RequestList& batch, std::byte* message, ULONG messageSize, std::byte* reply)
+        {
+            LARGE_INTEGER timeout;
+            timeout.QuadPart = -10000LL * m_config.timeoutMs;
+
+            ULONG replySize = m_config.maxReplySize;
+            NTSTATUS status = FltSendMessage(m_filter, &m_clientPort, message, messageSize, reply, &replySize, &timeout);
+
+            // STATUS_TIMEOUT is a success code
+            if (status == STATUS_TIMEOUT)
+            {
+                completeAll(batch, status);
+                return;
+            }
+
+            if (!NT_SUCCESS(status))
+            {
+                if (m_stopping)
+                {
+                    transferAll(batch, status);
+                }
+                else
+                {
+                    completeAll(batch, status);
+                }
+
+                return;
+            }
+
+            const auto messageId = reinterpret_cast<const FltPumpMessageHeader*>(message)->messageId;
+            auto replyHeader = reinterpret_cast<const FltPumpReplyHeader*>(reply);
+
+            if (replySize < sizeof(FltPumpReplyHeader) || replyHeader->messageId != messageId || replyHeader->size < sizeof(FltPumpReplyHeader) || replyHeader->size > replySize)
+            {
+                completeAll(batch, STATUS_INVALID_NETWORK_RESPONSE);
+                return;
+            }
+
+            ULONG offset = sizeof(FltPumpReplyHeader);
+            for (ULONG i = 0; i < replyHeader->eventCount && !batch.isEmpty(); ++i)
+            {
+                if (replyHeader->size - offset < sizeof(FltPumpEventReplyHeader))
+                {
+                    break;
+                }
+
+                auto eventReply = reinterpret_cast<const FltPumpEventReplyHeader*>(reply + offset);
+                if (eventReply->size > replyHeader->size - offset - sizeof(FltPumpEventReplyHeader))
+                {
+                    break;
+                }
+
+                for (auto it = batch.iterator(); it.hasNext();)
+                {
+                    auto request = it.next();
+
+                    if (request->m_id == eventReply->eventId)
+                    {
+                        it.remove();
+                        complete(request, eventReply->status, { reinterpret_cast<const std::byte*>(eventReply + 1), eventReply->size });
+                        break;
+                    }
+                }
+
+                const ULONG recordSize = fltPumpRecordSize<FltPumpEventReplyHeader>(eventReply->size);
+                if (recordSize > replyHeader->size - offset)
+                {
+                    break;
+                }
+
+                offset += recordSize;
+            }
+
+            completeAll(batch, STATUS_NOT_FOUND);
+        }
+
+    private:
+        // Shared by all pumps, so event IDs stay unique within a batch after rerouting
+        static inline atomic<ULONG64> s_nextId = 1;
+
+        Config                  m_config;
+        PFLT_FILTER             m_filter = nullptr;
+        PFLT_PORT               m_clientPort = nullptr;
+
+        SpinLock                m_lock;
+        RequestList             m_queue;
+        ULONG                   m_queued = 0;
+        atomic<ULONG>           m_inFlight = 0;
+        RerouteRoutine          m_reroute = nullptr;
+        PVOID                   m_rerouteContext = nullptr;
+
+        ThreadPool<kMaxThreads> m_threads;
+        Event                   m_wakeEvent;
+        atomic<bool>            m_stopping = false;
+        bool                    m_started = false;
+    };
+}
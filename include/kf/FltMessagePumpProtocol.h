@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+
+namespace kf
+{
+    //////////////////////////////////////////////////////////////////////////
+    // FltMessagePumpProtocol - wire format of FltMessagePump messages. This header has no kernel dependencies
+    // so the user-mode service can include it too.
+    //
+    // Message (follows FILTER_MESSAGE_HEADER on the user side):
+    //     FltPumpMessageHeader, then eventCount times FltPumpEventHeader followed by the event data.
+    // Reply (follows FILTER_REPLY_HEADER on the user side):
+    //     FltPumpReplyHeader with the messageId of the message, then FltPumpEventReplyHeader followed by
+    //     the reply data for every event the service answers, in any order.
+    // Event headers start at 8-byte aligned offsets, use fltPumpRecordSize() to step over a record.
+
+    struct FltPumpMessageHeader
+    {
+        uint64_t messageId;
+        uint32_t eventCount;
+        // Size of the whole message including this header
+        uint32_t size;
+    };
+
+    struct FltPumpEventHeader
+    {
+        uint64_t eventId;
+        uint32_t size;
+        uint32_t reserved;
+    };
+
+    struct FltPumpReplyHeader
+    {
+        uint64_t messageId;
+        uint32_t eventCount;
+        // Size of the whole reply including this header
+        uint32_t size;
+    };
+
+    struct FltPumpEventReplyHeader
+    {
+        uint64_t eventId;
+        // NTSTATUS passed to the completion routine of the event
+        int32_t  status;
+        uint32_t size;
+    };
+
+    static_assert(sizeof(FltPumpEventHeader) == 16 && sizeof(FltPumpEventReplyHeader) == 16);
+
+    template<class Header>
+    inline constexpr uint32_t fltPumpRecordSize(uint32_t dataSize)
+    {
+        return static_cast<uint32_t>((sizeof(Header) + dataSize + 7) & ~size_t(7));
+    }
+}
@@ -18,6 +18,27 @@ namespace kf
         {
         }
 
+#ifdef KF_LOCK_STATS
+        // Same as FltAcquireResourceXxx/FltReleaseResource but routed through the instrumented EResource methods
+
+        void fltAcquireExclusive()
+        {
+            KeEnterCriticalRegion();
+            acquireExclusive();
+        }
+
+        void fltAcquireShared()
+        {
+            KeEnterCriticalRegion();
+            acquireShared();
+        }
+
+        void fltRelease()
+        {
+            release();
+            KeLeaveCriticalRegion();
+        }
+#else
         void fltAcquireExclusive()
         {
             ::FltAcquireResourceExclusive(*this);
@@ -32,6 +53,7 @@ namespace kf
         {
             ::FltReleaseResource(*this);
         }
+#endif
 
     private:
         FltResource(const FltResource&);
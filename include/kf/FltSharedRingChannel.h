@@ -0,0 +1,375 @@
+#pragma once
+#include <atomic>
+#include "SharedRing.h"
+#include "SpinLock.h"
+#include "AutoSpinLock.h"
+#include "Semaphore.h"
+#include "EResource.h"
+#include "EResourceExclusiveLock.h"
+#include "AttachProcess.h"
+#include "Guard.h"
+#include "ScopeExit.h"
+
+namespace kf
+{
+    //////////////////////////////////////////////////////////////////////////
+    // FltSharedRingChannel - bulk delivery of driver events to a FltCommunicationPort client through a SharedRing
+    // mapped into the client process once, so there is no per-message MDL work.
+    //
+    // FltCommunicationPort stays for control messages. The client creates a data event and a space event and sends
+    // their handles in a control message. The handler calls map() from onMessage (which runs in the client process) and
+    // returns the user address. The handler calls unmap() from onDisconnect. The client consumes records with
+    // SharedRingConsumer.
+    //
+    // Signaling is batched. The data event is set only when the consumer announced it is going to sleep
+    // (SharedRingConsumer::prepareWait), and the client sets the space event only when a producer is waiting.
+    // Senders blocked for space sleep on a driver semaphore as well as on the space event: the one woken by the
+    // client passes the signal on to the rest, and unmap() releases them all.
+    //
+    // Client loop:
+    //     count = consumer.consume(handleRecord, kBatch, corrupted);
+    //     if (consumer.shouldWakeProducer()) SetEvent(spaceEvent);
+    //     if (!count && consumer.prepareWait()) WaitForSingleObject(dataEvent, INFINITE);
+    /*
+    NTSTATUS SampleHandler::onMessage(...)
+    {
+        auto request = static_cast<const MapRingRequest*>(inputBuffer); // { HANDLE dataEvent; HANDLE spaceEvent; }
+        auto reply = static_cast<MapRingReply*>(outputBuffer);         // { PVOID ring; }
+
+        NTSTATUS status = m_channel.map(request->dataEvent, request->spaceEvent, &reply->ring);
+        *returnOutputBufferLength = NT_SUCCESS(status) ? sizeof(MapRingReply) : 0;
+
+        return status;
+    }
+    */
+
+    class FltSharedRingChannel
+    {
+    public:
+        enum class BackPressure
+        {
+            // Fail the send with STATUS_DEVICE_BUSY and count the message in SharedRingHeader::dropped
+            Drop,
+            // Wait for the consumer to free space (PASSIVE_LEVEL/APC_LEVEL only, falls back to Drop above)
+            Wait
+        };
+
+        FltSharedRingChannel() : m_spaceAvailable(0, MAXLONG)
+        {
+            ExInitializeRundownProtection(&m_rundown);
+            ExWaitForRundownProtectionRelease(&m_rundown);
+        }
+
+        ~FltSharedRingChannel()
+        {
+            unmap();
+            free();
+        }
+
+        FltSharedRingChannel(const FltSharedRingChannel&) = delete;
+        FltSharedRingChannel& operator=(const FltSharedRingChannel&) = delete;
+
+        // Capacity is the size of the data area, it must be a power of 2 and at least PAGE_SIZE
+        NTSTATUS create(ULONG capacity, BackPressure backPressure = BackPressure::Drop)
+        {
+            ASSERT(!m_mdl);
+
+            if (capacity < PAGE_SIZE || (capacity & (capacity - 1)))
+            {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            PHYSICAL_ADDRESS lowAddress;
+            PHYSICAL_ADDRESS highAddress;
+            PHYSICAL_ADDRESS skipBytes;
+            lowAddress.QuadPart = 0;
+            highAddress.QuadPart = -1;
+            skipBytes.QuadPart = 0;
+
+            // Pages are zeroed, so nothing but the ring is exposed to the client
+            m_mdl = MmAllocatePagesForMdlEx(lowAddress, highAddress, skipBytes, sizeof(SharedRingHeader) + capacity, MmCached, MM_ALLOCATE_FULLY_REQUIRED);
+            if (!m_mdl)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            m_systemAddress = MmGetSystemAddressForMdlSafe(m_mdl, NormalPagePriority | MdlMappingNoExecute);
+            if (!m_systemAddress)
+            {
+                free();
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            m_producer.initialize(static_cast<SharedRingHeader*>(m_systemAddress), capacity);
+            m_capacity = capacity;
+            m_backPressure = backPressure;
+
+            return STATUS_SUCCESS;
+        }
+
+        // Must be called in the context of the client process. Control messages may arrive on several threads at once,
+        // map() and unmap() are serialized.
+        NTSTATUS map(HANDLE dataEvent, HANDLE spaceEvent, _Out_ PVOID* userAddress)
+        {
+            ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+            ASSERT(m_mdl);
+
+            *userAddress = nullptr;
+
+            EResourceExclusiveLock mapLock(m_mapLock);
+
+            if (m_userAddress)
+            {
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            Guard::Object dataEventObject;
+            NTSTATUS status = ObReferenceObjectByHandle(dataEvent, EVENT_MODIFY_STATE, *ExEventObjectType, UserMode, &dataEventObject.get(), nullptr);
+            if (!NT_SUCCESS(status))
+            {
+                return status;
+            }
+
+            Guard::Object spaceEventObject;
+            status = ObReferenceObjectByHandle(spaceEvent, SYNCHRONIZE | EVENT_MODIFY_STATE, *ExEventObjectType, UserMode, &spaceEventObject.get(), nullptr);
+            if (!NT_SUCCESS(status))
+            {
+                return status;
+            }
+
+            // Senders are run down until the end of map(), so the ring can be reset. A new client must see neither
+            // the records nor the positions and flags left by the previous one.
+            RtlZeroMemory(m_systemAddress, sizeof(SharedRingHeader) + m_capacity);
+            m_producer.initialize(static_cast<SharedRingHeader*>(m_systemAddress), m_capacity);
+
+            m_userAddress = mapToCurrentProcess(m_mdl);
+            if (!m_userAddress)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            ObReferenceObject(PsGetCurrentProcess());
+            m_process.reset(PsGetCurrentProcess());
+
+            m_dataEvent = std::move(dataEventObject);
+            m_spaceEvent = std::move(spaceEventObject);
+            m_disconnecting = false;
+
+            ExReInitializeRundownProtection(&m_rundown);
+
+            *userAddress = m_userAddress;
+            return STATUS_SUCCESS;
+        }
+
+        // Can be called from any process context, e.g. from onDisconnect
+        void unmap()
+        {
+            ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+
+            EResourceExclusiveLock mapLock(m_mapLock);
+
+            if (!m_userAddress)
+            {
+                return;
+            }
+
+            // Release senders waiting for space and wait for all senders to leave. Senders register as waiters under
+            // m_lock after checking m_disconnecting, so no one starts waiting after the count is taken.
+            LONG waiters;
+            {
+                AutoSpinLock lock(m_lock);
+                m_disconnecting = true;
+                waiters = m_spaceWaiters.load();
+            }
+
+            if (waiters > 0)
+            {
+                m_spaceAvailable.release(waiters);
+            }
+
+            ExWaitForRundownProtectionRelease(&m_rundown);
+
+            {
+                AttachProcess attach(m_process);
+                MmUnmapLockedPages(m_userAddress, m_mdl);
+            }
+
+            m_userAddress = nullptr;
+            m_process.reset();
+            m_dataEvent.reset();
+            m_spaceEvent.reset();
+        }
+
+        ULONG capacity() const
+        {
+            return m_capacity;
+        }
+
+        NTSTATUS send(span<const std::byte> message, _In_opt_ PLARGE_INTEGER timeout = nullptr)
+        {
+            return send(message.size(), [message](span<std::byte> destination)
+            {
+                RtlCopyMemory(destination.data(), message.data(), message.size());
+            }, timeout);
+        }
+
+        // Writer is called as writer(span<std::byte>) at DISPATCH_LEVEL to fill the message directly in the ring
+        template<class F>
+        NTSTATUS send(size_t size, F&& writer, _In_opt_ PLARGE_INTEGER timeout = nullptr)
+        {
+            if (!ExAcquireRundownProtection(&m_rundown))
+            {
+                return STATUS_PORT_DISCONNECTED;
+            }
+
+            SCOPE_EXIT{ ExReleaseRundownProtection(&m_rundown); };
+
+            const bool canWait = m_backPressure == BackPressure::Wait && KeGetCurrentIrql() <= APC_LEVEL;
+
+            // A relative timeout would restart on every wake-up without space, so it becomes a deadline once
+            LARGE_INTEGER deadline;
+            if (canWait && timeout && timeout->QuadPart < 0)
+            {
+                KeQuerySystemTime(&deadline);
+                deadline.QuadPart -= timeout->QuadPart;
+                timeout = &deadline;
+            }
+
+            for (;;)
+            {
+                bool written = false;
+                bool wakeConsumer = false;
+                bool wait = false;
+
+                {
+                    AutoSpinLock lock(m_lock);
+
+                    auto destination = m_producer.reserve(size);
+                    if (destination.data())
+                    {
+                        writer(destination);
+                        wakeConsumer = m_producer.commit();
+                        written = true;
+                    }
+                    else if (!canWait || m_disconnecting || size > m_producer.maxPayloadSize())
+                    {
+                        m_producer.recordDrop();
+                    }
+                    else
+                    {
+                        // Space may have been freed between reserve and prepareWait, then just retry
+                        wait = m_producer.prepareWait(size);
+                        if (wait)
+                        {
+                            m_spaceWaiters.fetch_add(1);
+                        }
+                    }
+                }
+
+                if (written)
+                {
+                    if (wakeConsumer)
+                    {
+                        KeSetEvent(static_cast<PKEVENT>(m_dataEvent.get()), IO_NO_INCREMENT, false);
+                    }
+
+                    return STATUS_SUCCESS;
+                }
+
+                // A registered waiter must wait even if unmap() has started, unmap() counted it and releases it
+                if (wait)
+                {
+                    NTSTATUS status = waitForSpace(timeout);
+                    if (status == STATUS_TIMEOUT)
+                    {
+                        m_producer.recordDrop();
+                        return STATUS_TIMEOUT;
+                    }
+
+                    continue;
+                }
+
+                if (!canWait || m_disconnecting || size > m_producer.maxPayloadSize())
+                {
+                    return m_disconnecting ? STATUS_PORT_DISCONNECTED : STATUS_DEVICE_BUSY;
+                }
+            }
+        }
+
+    private:
+        static PVOID mapToCurrentProcess(PMDL mdl)
+        {
+            //
+            // Mapping into user space raises an exception on failure, no objects with destructors are allowed here
+            //
+
+            __try
+            {
+                return MmMapLockedPagesSpecifyCache(mdl, UserMode, MmCached, nullptr, false, NormalPagePriority | MdlMappingNoExecute);
+            }
+            __except (EXCEPTION_EXECUTE_HANDLER)
+            {
+                return nullptr;
+            }
+        }
+
+        // The space event belongs to the client: an auto-reset one wakes a single sender and a manual-reset one may be
+        // left set. So the sender woken by it clears it and passes the signal on through the semaphore.
+        NTSTATUS waitForSpace(_In_opt_ PLARGE_INTEGER timeout)
+        {
+            PVOID objects[] = { static_cast<PKSEMAPHORE>(m_spaceAvailable), m_spaceEvent.get() };
+
+            NTSTATUS status = KeWaitForMultipleObjects(ARRAYSIZE(objects), objects, WaitAny, Executive, KernelMode, false, timeout, nullptr);
+            if (status == STATUS_WAIT_1)
+            {
+                // A sender that registers after the fence either is counted below or sees the next client signal
+                KeClearEvent(static_cast<PKEVENT>(m_spaceEvent.get()));
+                atomic_thread_fence(memory_order_seq_cst);
+            }
+
+            const LONG otherWaiters = m_spaceWaiters.fetch_sub(1) - 1;
+            if (status == STATUS_WAIT_1 && otherWaiters > 0)
+            {
+                // A permit left for a sender that has already gone only causes one extra iteration
+                m_spaceAvailable.release(otherWaiters);
+            }
+
+            return status;
+        }
+
+        void free()
+        {
+            if (m_mdl)
+            {
+                if (m_systemAddress)
+                {
+                    MmUnmapLockedPages(m_systemAddress, m_mdl);
+                    m_systemAddress = nullptr;
+                }
+
+                MmFreePagesFromMdl(m_mdl);
+                ExFreePool(m_mdl);
+                m_mdl = nullptr;
+            }
+        }
+
+    private:
+        SpinLock            m_lock;
+        SharedRingProducer  m_producer;
+        EX_RUNDOWN_REF      m_rundown;
+        atomic<bool>        m_disconnecting = false;
+        atomic<LONG>        m_spaceWaiters = 0;
+        Semaphore           m_spaceAvailable;
+        BackPressure        m_backPressure = BackPressure::Drop;
+        ULONG               m_capacity = 0;
+        // Guards the mapping state below, senders do not take it
+        EResource           m_mapLock;
+
+        PMDL                m_mdl = nullptr;
+        PVOID               m_systemAddress = nullptr;
+        PVOID               m_userAddress = nullptr;
+        Guard::EProcess     m_process;
+        Guard::Object       m_dataEvent;
+        Guard::Object       m_spaceEvent;
+    };
+}
@@ -0,0 +1,330 @@
+#pragma once
+#include <span>
+#include <cstring>
+#include <functional>
+#include "USimpleString.h"
+#include "ASimpleString.h"
+#include "UString.h"
+
+namespace kf
+{
+    using namespace std;
+
+    //////////////////////////////////////////////////////////////////////////
+    // Hash - fast non-cryptographic 64-bit hashing (the wyhash final4 algorithm) for hash tables and caches.
+    // Not suitable where an attacker can choose colliding keys unless a secret seed is used.
+
+    class Hash
+    {
+    public:
+        static ULONG64 bytes(span<const std::byte> data, ULONG64 seed = 0)
+        {
+            const auto p = reinterpret_cast<const uint8_t*>(data.data());
+            const size_t length = data.size();
+
+            seed ^= mix(seed ^ kSecret[0], kSecret[1]);
+
+            ULONG64 a;
+            ULONG64 b;
+
+            if (length <= 16)
+            {
+                shortInput(p, length, a, b);
+            }
+            else
+            {
+                size_t i = length;
+                const uint8_t* q = p;
+
+                if (i > 48)
+                {
+                    ULONG64 see1 = seed;
+                    ULONG64 see2 = seed;
+
+                    do
+                    {
+                        block(q, seed, see1, see2);
+                        q += 48;
+                        i -= 48;
+                    } while (i > 48);
+
+                    seed ^= see1 ^ see2;
+                }
+
+                while (i > 16)
+                {
+                    seed = mix(read8(q) ^ kSecret[1], read8(q + 8) ^ seed);
+                    q += 16;
+                    i -= 16;
+                }
+
+                a = read8(q + i - 16);
+                b = read8(q + i - 8);
+            }
+
+            return finish(a, b, seed, length);
+        }
+
+        static ULONG64 string(const USimpleString& str, ULONG64 seed = 0)
+        {
+            return bytes({ reinterpret_cast<const std::byte*>(str.buffer()), static_cast<size_t>(str.byteLength()) }, seed);
+        }
+
+        static ULONG64 string(const ASimpleString& str, ULONG64 seed = 0)
+        {
+            return bytes({ reinterpret_cast<const std::byte*>(str.string().Buffer), static_cast<size_t>(str.byteLength()) }, seed);
+        }
+
+        // Equal for strings equal by equalsIgnoreCase: the hash of the string upcased as RtlUpcaseUnicodeString does
+        static ULONG64 stringIgnoreCase(const USimpleString& str, ULONG64 seed = 0);
+
+        //////////////////////////////////////////////////////////////////////////
+        // Hash::Stream - incremental hashing of chunked data, the result is equal to Hash::bytes of the concatenation
+
+        class Stream
+        {
+        public:
+            explicit Stream(ULONG64 seed = 0)
+            {
+                m_seed = seed ^ mix(seed ^ kSecret[0], kSecret[1]);
+                m_see1 = m_seed;
+                m_see2 = m_seed;
+            }
+
+            void update(span<const std::byte> data)
+            {
+                auto p = reinterpret_cast<const uint8_t*>(data.data());
+                size_t size = data.size();
+
+                m_length += size;
+
+                // Blocks are processed only when more data follows them, exactly like bytes() does
+                if (m_pending + size <= 48)
+                {
+                    memcpy(m_buffer + kHistory + m_pending, p, size);
+                    m_pending += size;
+                    return;
+                }
+
+                if (m_pending)
+                {
+                    const size_t fill = 48 - m_pending;
+                    memcpy(m_buffer + kHistory + m_pending, p, fill);
+                    p += fill;
+                    size -= fill;
+
+                    block(m_buffer + kHistory, m_seed, m_see1, m_see2);
+                    m_blocks = true;
+                    m_pending = 0;
+
+                    // More data follows the block here, it was checked above
+                    memcpy(m_buffer, m_buffer + kHistory + 48 - kHistory, kHistory);
+                }
+
+                while (size > 48)
+                {
+                    block(p, m_seed, m_see1, m_see2);
+                    m_blocks = true;
+
+                    memcpy(m_buffer, p + 48 - kHistory, kHistory);
+                    p += 48;
+                    size -= 48;
+                }
+
+                memcpy(m_buffer + kHistory, p, size);
+                m_pending = size;
+            }
+
+            ULONG64 digest() const
+            {
+                ULONG64 seed = m_seed;
+                ULONG64 a;
+                ULONG64 b;
+
+                const uint8_t* q = m_buffer + kHistory;
+
+                if (m_length <= 16)
+                {
+                    shortInput(q, m_pending, a, b);
+                }
+                else
+                {
+                    if (m_blocks)
+                    {
+                        seed ^= m_see1 ^ m_see2;
+                    }
+
+                    size_t i = m_pending;
+                    while (i > 16)
+                    {
+                        seed = mix(read8(q) ^ kSecret[1], read8(q + 8) ^ seed);
+                        q += 16;
+                        i -= 16;
+                    }
+
+                    // The last 16 bytes may start in the history
+                    a = read8(q + i - 16);
+                    b = read8(q + i - 8);
+                }
+
+                return finish(a, b, seed, m_length);
+            }
+
+        private:
+            static constexpr size_t kHistory = 16;
+
+            // The last kHistory bytes of processed blocks followed by up to 48 pending bytes
+            uint8_t m_buffer[kHistory + 48] = {};
+            size_t  m_pending = 0;
+            size_t  m_length = 0;
+            bool    m_blocks = false;
+            ULONG64 m_seed;
+            ULONG64 m_see1;
+            ULONG64 m_see2;
+        };
+
+    private:
+        static constexpr ULONG64 kSecret[4] = { 0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL };
+
+        static ULONG64 read8(const uint8_t* p)
+        {
+            ULONG64 value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        static ULONG64 read4(const uint8_t* p)
+        {
+            uint32_t value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        // 64x64->128 multiplication, returns low and high halves in a and b
+        static void multiply(ULONG64& a, ULONG64& b)
+        {
+#if defined(_M_X64) || defined(_M_ARM64)
+            ULONG64 high;
+            a = UnsignedMultiply128(a, b, &high);
+            b = high;
+#else
+            const ULONG64 aLow = static_cast<uint32_t>(a);
+            const ULONG64 aHigh = a >> 32;
+            const ULONG64 bLow = static_cast<uint32_t>(b);
+            const ULONG64 bHigh = b >> 32;
+
+            const ULONG64 lowLow = aLow * bLow;
+            const ULONG64 lowHigh = aLow * bHigh;
+            const ULONG64 highLow = aHigh * bLow;
+            const ULONG64 highHigh = aHigh * bHigh;
+
+            const ULONG64 middle = (lowLow >> 32) + static_cast<uint32_t>(lowHigh) + static_cast<uint32_t>(highLow);
+
+            a = (middle << 32) | static_cast<uint32_t>(lowLow);
+            b = highHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+#endif
+        }
+
+        static ULONG64 mix(ULONG64 a, ULONG64 b)
+        {
+            multiply(a, b);
+            return a ^ b;
+        }
+
+        static void shortInput(const uint8_t* p, size_t length, _Out_ ULONG64& a, _Out_ ULONG64& b)
+        {
+            if (length >= 4)
+            {
+                const size_t shift = (length >> 3) << 2;
+                a = (read4(p) << 32) | read4(p + shift);
+                b = (read4(p + length - 4) << 32) | read4(p + length - 4 - shift);
+            }
+            else if (length > 0)
+            {
+                a = (static_cast<ULONG64>(p[0]) << 16) | (static_cast<ULONG64>(p[length >> 1]) << 8) | p[length - 1];
+                b = 0;
+            }
+            else
+            {
+                a = 0;
+                b = 0;
+            }
+        }
+
+        static void block(const uint8_t* p, ULONG64& seed, ULONG64& see1, ULONG64& see2)
+        {
+            seed = mix(read8(p) ^ kSecret[1], read8(p + 8) ^ seed);
+            see1 = mix(read8(p + 16) ^ kSecret[2], read8(p + 24) ^ see1);
+            see2 = mix(read8(p + 32) ^ kSecret[3], read8(p + 40) ^ see2);
+        }
+
+        static ULONG64 finish(ULONG64 a, ULONG64 b, ULONG64 seed, size_t length)
+        {
+            a ^= kSecret[1];
+            b ^= seed;
+            multiply(a, b);
+
+            return mix(a ^ kSecret[0] ^ length, b ^ kSecret[1]);
+        }
+    };
+
+    inline ULONG64 Hash::stringIgnoreCase(const USimpleString& str, ULONG64 seed)
+    {
+        Stream stream(seed);
+        WCHAR upcased[64];
+
+        for (int i = 0; i < str.charLength();)
+        {
+            const int count = min(str.charLength() - i, static_cast<int>(ARRAYSIZE(upcased)));
+
+            for (int j = 0; j < count; ++j)
+            {
+                const WCHAR ch = str.charAt(i + j);
+                upcased[j] = CaseInsensitive::isAscii(ch) ? CaseInsensitive::upcaseAscii(ch) : RtlUpcaseUnicodeChar(ch);
+            }
+
+            stream.update({ reinterpret_cast<const std::byte*>(upcased), count * sizeof(WCHAR) });
+            i += count;
+        }
+
+        return stream.digest();
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // Hash functors for unordered containers, HashIgnoreCase pairs with equalsIgnoreCase
+
+    struct HashIgnoreCase
+    {
+        size_t operator()(const USimpleString& str) const
+        {
+            return static_cast<size_t>(Hash::stringIgnoreCase(str));
+        }
+    };
+}
+
+template<>
+struct std::hash<kf::USimpleString>
+{
+    size_t operator()(const kf::USimpleString& str) const
+    {
+        return static_cast<size_t>(kf::Hash::string(str));
+    }
+};
+
+template<>
+struct std::hash<kf::ASimpleString>
+{
+    size_t operator()(const kf::ASimpleString& str) const
+    {
+        return static_cast<size_t>(kf::Hash::string(str));
+    }
+};
+
+template<POOL_TYPE poolType>
+struct std::hash<kf::UString<poolType>>
+{
+    size_t operator()(const kf::UString<poolType>& str) const
+    {
+        return static_cast<size_t>(kf::Hash::string(str));
+    }
+};
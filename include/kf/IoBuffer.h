@@ -0,0 +1,184 @@
+#pragma once
+#include <span>
+
+namespace kf
+{
+    using namespace std;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////////
+    // IoBuffer - page-aligned byte buffer for reading and writing file data, including non-cached I/O.
+    //
+    // resize_for_overwrite() neither initializes nor preserves the contents: the buffer is about to be overwritten by
+    // the I/O, so megabytes are not zeroed or copied for nothing. The allocation is rounded up to whole pages (this also
+    // makes pool allocations page-aligned) and reused while it is big enough. Contiguous backing is physically
+    // contiguous memory for code that hands the buffer to a device; large pages are not requested explicitly as the
+    // memory manager already maps big contiguous ranges with them where it can.
+    /*
+    IoBuffer<> buffer;
+    status = buffer.resize_for_overwrite(length);
+    status = FltReadFile(instance, fileObject, &offset, static_cast<ULONG>(buffer.size()), buffer.data(),
+        FLTFL_IO_OPERATION_NON_CACHED, &bytesRead, nullptr, nullptr);
+    */
+
+    enum class IoBufferBacking
+    {
+        Pool,
+        Contiguous,
+    };
+
+    template<POOL_TYPE poolType = NonPagedPoolNx>
+    class IoBuffer
+    {
+    public:
+        explicit IoBuffer(IoBufferBacking backing = IoBufferBacking::Pool) : m_backing(backing)
+        {
+        }
+
+        IoBuffer(_Inout_ IoBuffer&& another) : m_data(another.m_data), m_size(another.m_size), m_capacity(another.m_capacity), m_backing(another.m_backing)
+        {
+            another.m_data = nullptr;
+            another.m_size = 0;
+            another.m_capacity = 0;
+        }
+
+        ~IoBuffer()
+        {
+            free();
+        }
+
+        IoBuffer& operator=(_Inout_ IoBuffer&& another)
+        {
+            if (this != &another)
+            {
+                free();
+
+                m_data = another.m_data;
+                m_size = another.m_size;
+                m_capacity = another.m_capacity;
+                m_backing = another.m_backing;
+
+                another.m_data = nullptr;
+                another.m_size = 0;
+                another.m_capacity = 0;
+            }
+
+            return *this;
+        }
+
+        IoBuffer(const IoBuffer&) = delete;
+        IoBuffer& operator=(const IoBuffer&) = delete;
+
+        // Makes the buffer size bytes long with undefined contents. Must be called at IRQL <= APC_LEVEL for paged pool,
+        // at IRQL <= DISPATCH_LEVEL otherwise.
+        NTSTATUS resize_for_overwrite(size_t size)
+        {
+            if (size <= m_capacity)
+            {
+                m_size = size;
+                return STATUS_SUCCESS;
+            }
+
+            if (size > MAXSIZE_T - PAGE_SIZE)
+            {
+                return STATUS_INTEGER_OVERFLOW;
+            }
+
+            free();
+
+            const size_t capacity = ROUND_TO_PAGES(size);
+
+            if (m_backing == IoBufferBacking::Contiguous)
+            {
+                PHYSICAL_ADDRESS lowAddress;
+                PHYSICAL_ADDRESS highAddress;
+                PHYSICAL_ADDRESS boundaryAddressMultiple;
+                lowAddress.QuadPart = 0;
+                highAddress.QuadPart = -1;
+                boundaryAddressMultiple.QuadPart = 0;
+
+                m_data = static_cast<std::byte*>(MmAllocateContiguousMemorySpecifyCache(capacity, lowAddress, highAddress, boundaryAddressMultiple, MmCached));
+            }
+            else
+            {
+#pragma warning(suppress: 28160) // Must succeed pool allocations are forbidden. Allocation failures cause a system crash.
+                m_data = static_cast<std::byte*>(::ExAllocatePoolWithTag(poolType, capacity, PoolTag));
+            }
+
+            if (!m_data)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            ASSERT(!BYTE_OFFSET(m_data));
+
+            m_size = size;
+            m_capacity = capacity;
+
+            return STATUS_SUCCESS;
+        }
+
+        void free()
+        {
+            if (m_data)
+            {
+                if (m_backing == IoBufferBacking::Contiguous)
+                {
+                    MmFreeContiguousMemory(m_data);
+                }
+                else
+                {
+                    ::ExFreePoolWithTag(m_data, PoolTag);
+                }
+
+                m_data = nullptr;
+            }
+
+            m_size = 0;
+            m_capacity = 0;
+        }
+
+        std::byte* data()
+        {
+            return m_data;
+        }
+
+        const std::byte* data() const
+        {
+            return m_data;
+        }
+
+        size_t size() const
+        {
+            return m_size;
+        }
+
+        size_t capacity() const
+        {
+            return m_capacity;
+        }
+
+        bool empty() const
+        {
+            return !m_size;
+        }
+
+        operator span<std::byte>()
+        {
+            return { m_data, m_size };
+        }
+
+        operator span<const std::byte>() const
+        {
+            return { m_data, m_size };
+        }
+
+    private:
+        enum { PoolTag = 'BoIk' };
+
+    private:
+        std::byte*      m_data = nullptr;
+        size_t          m_size = 0;
+        size_t          m_capacity = 0;
+        IoBufferBacking m_backing;
+    };
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+namespace kf
+{
+    //////////////////////////////////////////////////////////////////////////
+    // LockFreeStackEntry - member of an element that can be pushed to LockFreeStack
+
+    struct LockFreeStackEntry : public SLIST_ENTRY
+    {
+        LockFreeStackEntry()
+        {
+            Next = nullptr;
+        }
+
+        LockFreeStackEntry(const LockFreeStackEntry&) = delete;
+        LockFreeStackEntry& operator=(const LockFreeStackEntry&) = delete;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // LockFreeStack - intrusive LIFO stack over SLIST_HEADER for any number of producers and consumers.
+    //
+    // Push and pop are single interlocked operations and can be called at any IRQL for elements in nonpaged memory.
+    // SLIST_HEADER carries a sequence number next to the first entry, so pop is not subject to the ABA problem, and the
+    // kernel handles a popped element being freed by another CPU at the same time. popAll() takes the whole stack with
+    // one exchange and hands the elements out in push order:
+    /*
+    // DPC
+    if (m_completed.push(*request))
+    {
+        m_wakeEvent.set();
+    }
+
+    // Worker thread
+    m_completed.popAll([](Request& request) { complete(request); });
+    */
+
+    template<class TElemType, LockFreeStackEntry TElemType::* TEntryMember>
+    class LockFreeStack
+    {
+    public:
+        LockFreeStack()
+        {
+            ::InitializeSListHead(&m_head);
+        }
+
+        ~LockFreeStack()
+        {
+            ASSERT(isEmpty());
+        }
+
+        LockFreeStack(const LockFreeStack&) = delete;
+        LockFreeStack& operator=(const LockFreeStack&) = delete;
+
+        // Returns true if the stack was empty, e.g. to wake up the consumer only once per batch
+        bool push(_Inout_ TElemType& element)
+        {
+            return !::InterlockedPushEntrySList(&m_head, toEntry(element));
+        }
+
+        TElemType* pop()
+        {
+            auto entry = ::InterlockedPopEntrySList(&m_head);
+            return entry ? fromEntry(entry) : nullptr;
+        }
+
+        // Takes all the elements at once and calls routine(TElemType&) for each of them in push order, returns their
+        // count. The routine may free the element.
+        template<class Routine>
+        size_t popAll(Routine routine)
+        {
+            PSLIST_ENTRY reversed = nullptr;
+
+            for (auto entry = ::InterlockedFlushSList(&m_head); entry;)
+            {
+                auto next = entry->Next;
+                entry->Next = reversed;
+                reversed = entry;
+                entry = next;
+            }
+
+            size_t count = 0;
+
+            while (reversed)
+            {
+                auto next = reversed->Next;
+                routine(*fromEntry(reversed));
+                reversed = next;
+                ++count;
+            }
+
+            return count;
+        }
+
+        bool isEmpty() const
+        {
+            return !::FirstEntrySList(&m_head);
+        }
+
+        // The number of elements at the moment of the call
+        USHORT depth()
+        {
+            return ::QueryDepthSList(&m_head);
+        }
+
+    private:
+        static TElemType* fromEntry(_In_ PSLIST_ENTRY entry)
+        {
+            // Implementation of CONTAINING_RECORD macro
+            return reinterpret_cast<TElemType*>(reinterpret_cast<char*>(entry) - reinterpret_cast<ULONG_PTR>(&(static_cast<TElemType*>(0)->*TEntryMember)));
+        }
+
+        static PSLIST_ENTRY toEntry(_In_ TElemType& element)
+        {
+            return &(element.*TEntryMember);
+        }
+
+    private:
+        SLIST_HEADER m_head;
+    };
+}
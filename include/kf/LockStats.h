@@ -0,0 +1,340 @@
+#pragma once
+#include <wdm.h>
+
+#ifndef KF_LOCK_STATS_CPU_SLOTS
+#define KF_LOCK_STATS_CPU_SLOTS 8
+#endif
+
+namespace kf
+{
+    //////////////////////////////////////////////////////////////////////////
+    // LockStats - per lock contention statistics, compiled in only when KF_LOCK_STATS is defined.
+    //
+    // Counters are spread over per-CPU slots so recording does not add a shared cache line to the lock. The slots are
+    // allocated apart from the lock, so an instrumented lock grows by a few pointers only; if the allocation fails
+    // the lock simply has no statistics. KF_LOCK_STATS_CPU_SLOTS sets the number of slots (a slot is about 450 bytes).
+    // Histograms are log2 buckets of KeQueryPerformanceCounter ticks: bucket 0 counts 0 ticks,
+    // bucket i counts [2^(i-1), 2^i) ticks, the last bucket counts everything above.
+
+    class LockStats
+    {
+    public:
+        static constexpr int kHistogramBuckets = 24;
+        static constexpr int kCpuSlots = KF_LOCK_STATS_CPU_SLOTS;
+
+        struct Snapshot
+        {
+            const char* name;
+            LONGLONG    frequency;
+            LONG64      acquisitions;
+            LONG64      contentions;
+            LONG64      waitHistogram[kHistogramBuckets];
+            LONG64      holdHistogram[kHistogramBuckets];
+        };
+
+        explicit LockStats(_In_opt_ const char* name = nullptr);
+        ~LockStats();
+
+        LockStats(const LockStats&) = delete;
+        LockStats& operator=(const LockStats&) = delete;
+
+        const char* name() const
+        {
+            return m_name;
+        }
+
+        void setName(_In_opt_ const char* name)
+        {
+            m_name = name;
+        }
+
+        // Calls tryAcquire(false) first, and only if it fails and wait is requested measures tryAcquire(true)
+        template<class F>
+        bool acquire(bool wait, F&& tryAcquire);
+
+        // Exclusive hold time is tracked for the owner thread, recursive acquisitions by the owner (shared ones
+        // included) extend the hold. endAllExclusiveHolds() ends the hold whatever the depth, e.g. on a conversion.
+        void beginExclusiveHold(ERESOURCE_THREAD owner);
+        void endExclusiveHold();
+        void endAllExclusiveHolds();
+
+        bool isExclusiveOwner(ERESOURCE_THREAD thread) const
+        {
+            return m_exclusiveOwner == thread;
+        }
+
+        void recordAcquisition(bool contended, LONGLONG waitTicks);
+        void recordHold(LONGLONG holdTicks);
+
+        void snapshot(_Out_ Snapshot& result) const;
+        void reset();
+
+        static LONGLONG now()
+        {
+            return KeQueryPerformanceCounter(nullptr).QuadPart;
+        }
+
+    private:
+        friend class LockStatsRegistry;
+
+        struct alignas(64) Slot
+        {
+            volatile LONG64 acquisitions;
+            volatile LONG64 contentions;
+            volatile LONG64 waitHistogram[kHistogramBuckets];
+            volatile LONG64 holdHistogram[kHistogramBuckets];
+        };
+
+        static int bucket(LONGLONG ticks);
+
+        Slot* currentSlot()
+        {
+            return m_slots ? &m_slots[KeGetCurrentProcessorIndex() % kCpuSlots] : nullptr;
+        }
+
+        enum { PoolTag = 'tSkL' };
+
+    private:
+        Slot*       m_slots = nullptr;
+        PVOID       m_slotsAllocation = nullptr;
+        const char* m_name;
+        LIST_ENTRY  m_registryEntry;
+
+        // Written only by the exclusive owner, other threads never find their own ID in m_exclusiveOwner
+        ULONG       m_exclusiveDepth = 0;
+        LONGLONG    m_exclusiveHoldStart = 0;
+        volatile ERESOURCE_THREAD m_exclusiveOwner = 0;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // LockStatsRegistry - all live LockStats instances, used to dump a snapshot
+
+    class LockStatsRegistry
+    {
+    public:
+        // Callback is called as callback(const LockStats::Snapshot&) at DISPATCH_LEVEL
+        template<class F>
+        static void forEach(F&& callback)
+        {
+            KIRQL oldIrql;
+            KeAcquireSpinLock(&s_lock, &oldIrql);
+
+            for (auto entry = s_head.Flink; entry && entry != &s_head; entry = entry->Flink)
+            {
+                LockStats::Snapshot snapshot;
+                CONTAINING_RECORD(entry, LockStats, m_registryEntry)->snapshot(snapshot);
+
+                callback(static_cast<const LockStats::Snapshot&>(snapshot));
+            }
+
+            KeReleaseSpinLock(&s_lock, oldIrql);
+        }
+
+        static void dump()
+        {
+            forEach([](const LockStats::Snapshot& snapshot)
+            {
+                DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "kf lock %s: acquisitions=%lld contentions=%lld frequency=%lld\n",
+                    snapshot.name ? snapshot.name : "<unnamed>", snapshot.acquisitions, snapshot.contentions, snapshot.frequency);
+
+                for (int i = 0; i < LockStats::kHistogramBuckets; ++i)
+                {
+                    if (snapshot.waitHistogram[i] || snapshot.holdHistogram[i])
+                    {
+                        DbgPrintEx(DPFLTR_IHVDRIVER_ID, DPFLTR_INFO_LEVEL, "  <2^%d ticks: wait=%lld hold=%lld\n",
+                            i, snapshot.waitHistogram[i], snapshot.holdHistogram[i]);
+                    }
+                }
+            });
+        }
+
+    private:
+        friend class LockStats;
+
+        static void add(_Inout_ LockStats& stats)
+        {
+            KIRQL oldIrql;
+            KeAcquireSpinLock(&s_lock, &oldIrql);
+
+            if (!s_head.Flink)
+            {
+                InitializeListHead(&s_head);
+            }
+
+            InsertTailList(&s_head, &stats.m_registryEntry);
+            KeReleaseSpinLock(&s_lock, oldIrql);
+        }
+
+        static void remove(_Inout_ LockStats& stats)
+        {
+            KIRQL oldIrql;
+            KeAcquireSpinLock(&s_lock, &oldIrql);
+            RemoveEntryList(&stats.m_registryEntry);
+            KeReleaseSpinLock(&s_lock, oldIrql);
+        }
+
+    private:
+        // Both are zero-initialized (the head lazily under the lock), so the registry works before any global constructors run
+        static inline KSPIN_LOCK s_lock = 0;
+        static inline LIST_ENTRY s_head = {};
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////////
+    // LockStats - inline
+
+    inline LockStats::LockStats(_In_opt_ const char* name) : m_name(name)
+    {
+        // Pool allocations are only 16-byte aligned, the slots are aligned to cache lines by hand
+        m_slotsAllocation = ::ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(Slot) * kCpuSlots + alignof(Slot) - 1, PoolTag);
+        if (m_slotsAllocation)
+        {
+            const auto address = (reinterpret_cast<ULONG_PTR>(m_slotsAllocation) + alignof(Slot) - 1) & ~static_cast<ULONG_PTR>(alignof(Slot) - 1);
+            m_slots = reinterpret_cast<Slot*>(address);
+            RtlZeroMemory(m_slots, sizeof(Slot) * kCpuSlots);
+        }
+
+        LockStatsRegistry::add(*this);
+    }
+
+    inline LockStats::~LockStats()
+    {
+        LockStatsRegistry::remove(*this);
+
+        if (m_slotsAllocation)
+        {
+            ::ExFreePoolWithTag(m_slotsAllocation, PoolTag);
+        }
+    }
+
+    template<class F>
+    inline bool LockStats::acquire(bool wait, F&& tryAcquire)
+    {
+        if (tryAcquire(false))
+        {
+            recordAcquisition(false, 0);
+            return true;
+        }
+
+        if (!wait)
+        {
+            return false;
+        }
+
+        const auto start = now();
+        if (!tryAcquire(true))
+        {
+            return false;
+        }
+
+        recordAcquisition(true, now() - start);
+        return true;
+    }
+
+    inline void LockStats::beginExclusiveHold(ERESOURCE_THREAD owner)
+    {
+        if (m_exclusiveDepth++ == 0)
+        {
+            m_exclusiveHoldStart = now();
+            m_exclusiveOwner = owner;
+        }
+    }
+
+    inline void LockStats::endExclusiveHold()
+    {
+        if (m_exclusiveDepth > 0 && --m_exclusiveDepth == 0)
+        {
+            m_exclusiveOwner = 0;
+            recordHold(now() - m_exclusiveHoldStart);
+        }
+    }
+
+    inline void LockStats::endAllExclusiveHolds()
+    {
+        if (m_exclusiveDepth > 0)
+        {
+            m_exclusiveDepth = 1;
+            endExclusiveHold();
+        }
+    }
+
+    inline void LockStats::recordAcquisition(bool contended, LONGLONG waitTicks)
+    {
+        auto slot = currentSlot();
+        if (!slot)
+        {
+            return;
+        }
+
+        InterlockedIncrement64(&slot->acquisitions);
+
+        if (contended)
+        {
+            InterlockedIncrement64(&slot->contentions);
+            InterlockedIncrement64(&slot->waitHistogram[bucket(waitTicks)]);
+        }
+    }
+
+    inline void LockStats::recordHold(LONGLONG holdTicks)
+    {
+        auto slot = currentSlot();
+        if (slot)
+        {
+            InterlockedIncrement64(&slot->holdHistogram[bucket(holdTicks)]);
+        }
+    }
+
+    inline void LockStats::snapshot(_Out_ Snapshot& result) const
+    {
+        RtlZeroMemory(&result, sizeof(result));
+
+        LARGE_INTEGER frequency;
+        KeQueryPerformanceCounter(&frequency);
+
+        result.name = m_name;
+        result.frequency = frequency.QuadPart;
+
+        for (int index = 0; m_slots && index < kCpuSlots; ++index)
+        {
+            const auto& slot = m_slots[index];
+
+            result.acquisitions += slot.acquisitions;
+            result.contentions += slot.contentions;
+
+            for (int i = 0; i < kHistogramBuckets; ++i)
+            {
+                result.waitHistogram[i] += slot.waitHistogram[i];
+                result.holdHistogram[i] += slot.holdHistogram[i];
+            }
+        }
+    }
+
+    inline void LockStats::reset()
+    {
+        for (int index = 0; m_slots && index < kCpuSlots; ++index)
+        {
+            auto& slot = m_slots[index];
+
+            InterlockedExchange64(&slot.acquisitions, 0);
+            InterlockedExchange64(&slot.contentions, 0);
+
+            for (int i = 0; i < kHistogramBuckets; ++i)
+            {
+                InterlockedExchange64(&slot.waitHistogram[i], 0);
+                InterlockedExchange64(&slot.holdHistogram[i], 0);
+            }
+        }
+    }
+
+    inline int LockStats::bucket(LONGLONG ticks)
+    {
+        if (ticks <= 0)
+        {
+            return 0;
+        }
+
+        ULONG index;
+        _BitScanReverse64(&index, static_cast<ULONG64>(ticks));
+
+        return min(static_cast<int>(index) + 1, kHistogramBuckets - 1);
+    }
+}
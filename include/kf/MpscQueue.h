@@ -0,0 +1,181 @@
+#pragma once
+#include <atomic>
+#include <span>
+
+namespace kf
+{
+    using namespace std;
+
+    //////////////////////////////////////////////////////////////////////////
+    // MpscQueueEntry - member of an element that can be pushed to MpscQueue
+
+    struct MpscQueueEntry
+    {
+        MpscQueueEntry()
+        {
+        }
+
+        MpscQueueEntry(const MpscQueueEntry&) = delete;
+        MpscQueueEntry& operator=(const MpscQueueEntry&) = delete;
+
+        atomic<MpscQueueEntry*> next = nullptr;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // MpscQueue - intrusive FIFO queue for many producers and a single consumer (Dmitry Vyukov's node-based queue).
+    //
+    // push() is one exchange whatever the number of producers, pushMany() links the elements beforehand and adds them
+    // all with the same single exchange. Producers can call them at any IRQL for elements in nonpaged memory, they raise
+    // IRQL to DISPATCH_LEVEL for the few instructions between the exchange and linking the previous element, because
+    // until then the consumer can not see the elements pushed after it. So pop() may return nullptr while a push on
+    // another CPU is completing, the consumer is expected to be woken up again by the producer (e.g. with an Event).
+    // pop(), popAll() and isEmpty() must be called by one consumer at a time.
+    /*
+    // DPC
+    m_queue.push(*request);
+    m_wakeEvent.set();
+
+    // Worker thread
+    m_wakeEvent.wait();
+    m_queue.popAll([](Request& request) { complete(request); });
+    */
+
+    template<class TElemType, MpscQueueEntry TElemType::* TEntryMember>
+    class MpscQueue
+    {
+    public:
+        MpscQueue()
+        {
+        }
+
+        ~MpscQueue()
+        {
+            ASSERT(isEmpty());
+        }
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        void push(_Inout_ TElemType& element)
+        {
+            auto entry = toEntry(element);
+            pushChain(entry, entry);
+        }
+
+        // Adds the elements in the given order with one interlocked operation
+        void pushMany(span<TElemType* const> elements)
+        {
+            if (elements.empty())
+            {
+                return;
+            }
+
+            for (size_t i = 1; i < elements.size(); ++i)
+            {
+                toEntry(*elements[i - 1])->next.store(toEntry(*elements[i]), memory_order_relaxed);
+            }
+
+            pushChain(toEntry(*elements.front()), toEntry(*elements.back()));
+        }
+
+        TElemType* pop()
+        {
+            MpscQueueEntry* tail = m_tail;
+            MpscQueueEntry* next = tail->next.load(memory_order_acquire);
+
+            if (tail == &m_stub)
+            {
+                if (!next)
+                {
+                    return nullptr;
+                }
+
+                m_tail = next;
+                tail = next;
+                next = next->next.load(memory_order_acquire);
+            }
+
+            if (next)
+            {
+                m_tail = next;
+                return fromEntry(tail);
+            }
+
+            if (tail != m_head.load(memory_order_acquire))
+            {
+                // A producer has taken the head but not linked it yet
+                return nullptr;
+            }
+
+            // The last element can be taken only when another one is behind it, the stub is put there
+            pushChain(&m_stub, &m_stub);
+
+            next = tail->next.load(memory_order_acquire);
+            if (next)
+            {
+                m_tail = next;
+                return fromEntry(tail);
+            }
+
+            return nullptr;
+        }
+
+        // Calls routine(TElemType&) for every element that can be popped, returns their count. The routine may free
+        // the element.
+        template<class Routine>
+        size_t popAll(Routine routine)
+        {
+            size_t count = 0;
+
+            while (auto element = pop())
+            {
+                routine(*element);
+                ++count;
+            }
+
+            return count;
+        }
+
+        bool isEmpty() const
+        {
+            return m_tail == &m_stub && m_head.load(memory_order_acquire) == &m_stub;
+        }
+
+    private:
+        void pushChain(_Inout_ MpscQueueEntry* first, _Inout_ MpscQueueEntry* last)
+        {
+            last->next.store(nullptr, memory_order_relaxed);
+
+            KIRQL oldIrql = KeGetCurrentIrql();
+            if (oldIrql < DISPATCH_LEVEL)
+            {
+                KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+            }
+
+            auto prev = m_head.exchange(last, memory_order_acq_rel);
+            prev->next.store(first, memory_order_release);
+
+            if (oldIrql < DISPATCH_LEVEL)
+            {
+                KeLowerIrql(oldIrql);
+            }
+        }
+
+        static TElemType* fromEntry(_In_ MpscQueueEntry* entry)
+        {
+            // Implementation of CONTAINING_RECORD macro
+            return reinterpret_cast<TElemType*>(reinterpret_cast<char*>(entry) - reinterpret_cast<ULONG_PTR>(&(static_cast<TElemType*>(0)->*TEntryMember)));
+        }
+
+        static MpscQueueEntry* toEntry(_In_ TElemType& element)
+        {
+            return &(element.*TEntryMember);
+        }
+
+    private:
+        // Producers exchange the last element, the consumer takes elements from the first one
+        atomic<MpscQueueEntry*> m_head = &m_stub;
+        MpscQueueEntry*         m_tail = &m_stub;
+        MpscQueueEntry          m_stub;
+    };
+}
@@ -0,0 +1,173 @@
+#pragma once
+#include "FilenameUtils.h"
+
+namespace kf
+{
+    ///////////////////////////////////////////////////////////////////////////////////////////////////
+    // ParsedPath - a path tokenized once, for code that asks several FilenameUtils questions about the same path.
+    //
+    // The constructor scans the path a single time and records the component boundaries and the positions of the last
+    // separator, the stream colon and the extension dot. The accessors return the same results as the corresponding
+    // FilenameUtils functions in O(1). Components beyond kMaxComponents are not indexed, subpath() falls back to
+    // FilenameUtils::subpath for them. The path is not copied and must outlive the object.
+
+    template<int kMaxComponents = 32>
+    class ParsedPath
+    {
+    public:
+        explicit ParsedPath(const USimpleString& path) : m_path(path)
+        {
+            parse();
+        }
+
+        const USimpleString& path() const
+        {
+            return m_path;
+        }
+
+        // FilenameUtils::getNameCount
+        int getNameCount() const
+        {
+            return m_count;
+        }
+
+        // FilenameUtils::getName
+        USimpleString getName() const
+        {
+            return m_path.substring(m_lastSeparator > 0 ? m_lastSeparator + 1 : 0);
+        }
+
+        // FilenameUtils::getFileNameNoStream
+        USimpleString getFileNameNoStream() const
+        {
+            return m_streamColon > 0 ? m_path.substring(0, m_streamColon) : m_path;
+        }
+
+        // The stream part of the last component without the colon, e.g. "s:$DATA" for "\\dir\\file:s:$DATA"
+        USimpleString getStream() const
+        {
+            return m_streamColon > 0 ? m_path.substring(m_streamColon + 1) : USimpleString();
+        }
+
+        // FilenameUtils::getExtension
+        USimpleString getExtension() const
+        {
+            if (m_extensionDot <= 0)
+            {
+                return L"";
+            }
+
+            return m_path.substring(m_extensionDot + 1, m_streamColon > 0 ? m_streamColon : m_path.charLength());
+        }
+
+        // FilenameUtils::subpath
+        USimpleString subpath(int elementBeginIndex, int elementCount = (numeric_limits<int>::max)()) const
+        {
+            if (elementBeginIndex < 0 || elementCount < 0 || elementBeginIndex >= m_count || !elementCount)
+            {
+                return USimpleString{};
+            }
+
+            const int elementEndIndex = elementCount > m_count - elementBeginIndex ? m_count : elementBeginIndex + elementCount;
+            if (elementEndIndex > kMaxComponents)
+            {
+                return FilenameUtils::subpath(m_path, elementBeginIndex, elementCount);
+            }
+
+            return m_path.substring(m_begin[elementBeginIndex], m_end[elementEndIndex - 1]);
+        }
+
+        // FilenameUtils::getServerAndShareName
+        USimpleString getServerAndShareName() const
+        {
+            static constexpr UNICODE_STRING kMupPrefix = RTL_CONSTANT_STRING(L"\\Device\\Mup\\");
+
+            if (m_count < 3 || !m_path.startsWithIgnoreCase(kMupPrefix))
+            {
+                return {};
+            }
+
+            auto serverAndShare = subpath(2, 2);
+            if (serverAndShare.isEmpty())
+            {
+                return {};
+            }
+
+            // With the separator before the server
+            return USimpleString(span{ serverAndShare.begin() - 1, serverAndShare.end() });
+        }
+
+    private:
+        void parse()
+        {
+            const int length = m_path.charLength();
+            const WCHAR* chars = m_path.buffer();
+
+            int componentBegin = -1;
+            int lastDot = -1;
+            int dotBeforeColon = -1;
+
+            for (int i = 0; i < length; ++i)
+            {
+                switch (chars[i])
+                {
+                case L'\\':
+                    if (componentBegin >= 0)
+                    {
+                        addComponent(componentBegin, i);
+                        componentBegin = -1;
+                    }
+
+                    m_lastSeparator = i;
+                    m_streamColon = -1;
+                    continue;
+
+                case L':':
+                    if (m_streamColon < 0)
+                    {
+                        m_streamColon = i;
+                        dotBeforeColon = lastDot;
+                    }
+                    break;
+
+                case L'.':
+                    lastDot = i;
+                    break;
+                }
+
+                if (componentBegin < 0)
+                {
+                    componentBegin = i;
+                }
+            }
+
+            if (componentBegin >= 0)
+            {
+                addComponent(componentBegin, length);
+            }
+
+            m_extensionDot = m_streamColon > 0 ? dotBeforeColon : lastDot;
+        }
+
+        void addComponent(int begin, int end)
+        {
+            if (m_count < kMaxComponents)
+            {
+                m_begin[m_count] = static_cast<USHORT>(begin);
+                m_end[m_count] = static_cast<USHORT>(end);
+            }
+
+            ++m_count;
+        }
+
+    private:
+        USimpleString   m_path;
+        int             m_count = 0;
+        int             m_lastSeparator = -1;
+        // The first colon after the last separator
+        int             m_streamColon = -1;
+        int             m_extensionDot = -1;
+        USHORT          m_begin[kMaxComponents];
+        USHORT          m_end[kMaxComponents];
+    };
+}
@@ -0,0 +1,303 @@
+#pragma once
+#include "USimpleString.h"
+#include "Hash.h"
+#include "EResource.h"
+#include "EResourceSharedLock.h"
+#include "EResourceExclusiveLock.h"
+
+namespace kf
+{
+    namespace detail
+    {
+        class PathAtomTableBase;
+
+        struct PathAtomEntry
+        {
+            PathAtomEntry*      m_next;
+            PathAtomTableBase*  m_table;
+            volatile LONG       m_refCount;
+            ULONG64             m_hash;
+            UNICODE_STRING      m_string;
+
+            WCHAR* buffer()
+            {
+                return reinterpret_cast<WCHAR*>(this + 1);
+            }
+        };
+
+        class PathAtomTableBase
+        {
+        public:
+            virtual void remove(PathAtomEntry* entry) = 0;
+
+        protected:
+            ~PathAtomTableBase() = default;
+        };
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // PathAtom - reference counted handle of a path interned in a PathAtomTable.
+    //
+    // Paths equal by equalsIgnoreCase share a single atom, so equality is a pointer compare. The upcased string, its
+    // length and 64-bit hash are computed once. operator< orders by hash first (not alphabetically), it is meant for
+    // TreeMap/TreeSet keys where a lookup then costs integer compares instead of string compares on every level.
+    // Handles can be copied freely, the last one must be released at IRQL <= APC_LEVEL.
+
+    class PathAtom
+    {
+    public:
+        PathAtom() : m_entry(nullptr)
+        {
+        }
+
+        PathAtom(const PathAtom& another) : m_entry(another.m_entry)
+        {
+            if (m_entry)
+            {
+                InterlockedIncrement(&m_entry->m_refCount);
+            }
+        }
+
+        PathAtom(_Inout_ PathAtom&& another) : m_entry(another.m_entry)
+        {
+            another.m_entry = nullptr;
+        }
+
+        ~PathAtom()
+        {
+            reset();
+        }
+
+        PathAtom& operator=(const PathAtom& another)
+        {
+            PathAtom tmp(another);
+            return *this = std::move(tmp);
+        }
+
+        PathAtom& operator=(_Inout_ PathAtom&& another)
+        {
+            if (this != &another)
+            {
+                reset();
+
+                m_entry = another.m_entry;
+                another.m_entry = nullptr;
+            }
+
+            return *this;
+        }
+
+        void reset()
+        {
+            if (m_entry)
+            {
+                if (InterlockedDecrement(&m_entry->m_refCount) == 0)
+                {
+                    m_entry->m_table->remove(m_entry);
+                }
+
+                m_entry = nullptr;
+            }
+        }
+
+        explicit operator bool() const
+        {
+            return m_entry != nullptr;
+        }
+
+        // The upcased path
+        USimpleString string() const
+        {
+            return m_entry ? USimpleString(m_entry->m_string) : USimpleString();
+        }
+
+        int charLength() const
+        {
+            return m_entry ? m_entry->m_string.Length / sizeof(WCHAR) : 0;
+        }
+
+        ULONG64 hash() const
+        {
+            return m_entry ? m_entry->m_hash : 0;
+        }
+
+        bool operator==(const PathAtom& another) const
+        {
+            return m_entry == another.m_entry;
+        }
+
+        bool operator!=(const PathAtom& another) const
+        {
+            return m_entry != another.m_entry;
+        }
+
+        bool operator<(const PathAtom& another) const
+        {
+            if (hash() != another.hash())
+            {
+                return hash() < another.hash();
+            }
+
+            return m_entry < another.m_entry;
+        }
+
+    private:
+        template<POOL_TYPE poolType, int kBuckets>
+        friend class PathAtomTable;
+
+        // Takes over the reference
+        explicit PathAtom(detail::PathAtomEntry* entry) : m_entry(entry)
+        {
+        }
+
+    private:
+        detail::PathAtomEntry* m_entry;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // PathAtomTable - hash table of interned paths. Lookups run in parallel under a shared lock,
+    // the table must outlive all its atoms.
+
+    template<POOL_TYPE poolType = PagedPool, int kBuckets = 1024>
+    class PathAtomTable : private detail::PathAtomTableBase
+    {
+        static_assert((kBuckets & (kBuckets - 1)) == 0, "kBuckets must be a power of 2");
+
+    public:
+        PathAtomTable()
+        {
+        }
+
+        ~PathAtomTable()
+        {
+            ASSERT(!m_size);
+        }
+
+        PathAtomTable(const PathAtomTable&) = delete;
+        PathAtomTable& operator=(const PathAtomTable&) = delete;
+
+        // Must be called at IRQL <= APC_LEVEL
+        NTSTATUS intern(const USimpleString& path, _Out_ PathAtom& atom)
+        {
+            atom.reset();
+
+            const ULONG64 hash = Hash::stringIgnoreCase(path);
+
+            {
+                EResourceSharedLock lock(m_lock);
+
+                if (auto entry = find(path, hash))
+                {
+                    atom = PathAtom(entry);
+                    return STATUS_SUCCESS;
+                }
+            }
+
+            auto entry = reinterpret_cast<detail::PathAtomEntry*>(new(poolType) std::byte[sizeof(detail::PathAtomEntry) + path.byteLength()]);
+            if (!entry)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            entry->m_table = this;
+            entry->m_refCount = 1;
+            entry->m_hash = hash;
+            entry->m_string.Buffer = entry->buffer();
+            entry->m_string.Length = 0;
+            entry->m_string.MaximumLength = static_cast<USHORT>(path.byteLength());
+
+            NTSTATUS status = RtlUpcaseUnicodeString(&entry->m_string, &path.string(), FALSE);
+            if (!NT_SUCCESS(status))
+            {
+                delete[] reinterpret_cast<std::byte*>(entry);
+                return status;
+            }
+
+            {
+                EResourceExclusiveLock lock(m_lock);
+
+                // Somebody could intern the same path meanwhile
+                if (auto existing = find(path, hash))
+                {
+                    delete[] reinterpret_cast<std::byte*>(entry);
+                    atom = PathAtom(existing);
+                    return STATUS_SUCCESS;
+                }
+
+                auto& bucket = m_buckets[hash & (kBuckets - 1)];
+                entry->m_next = bucket;
+                bucket = entry;
+                ++m_size;
+            }
+
+            atom = PathAtom(entry);
+            return STATUS_SUCCESS;
+        }
+
+        // Returns an empty atom if the path is not interned, must be called at IRQL <= APC_LEVEL
+        PathAtom lookup(const USimpleString& path)
+        {
+            const ULONG64 hash = Hash::stringIgnoreCase(path);
+
+            EResourceSharedLock lock(m_lock);
+
+            return PathAtom(find(path, hash));
+        }
+
+        ULONG size() const
+        {
+            return m_size;
+        }
+
+    private:
+        // Must be called under the lock, returns the entry with a new reference. Entries whose count dropped to zero
+        // are being removed and are never revived.
+        detail::PathAtomEntry* find(const USimpleString& path, ULONG64 hash)
+        {
+            for (auto entry = m_buckets[hash & (kBuckets - 1)]; entry; entry = entry->m_next)
+            {
+                if (entry->m_hash != hash || !path.equalsIgnoreCase(entry->m_string))
+                {
+                    continue;
+                }
+
+                for (LONG count = entry->m_refCount; count > 0;)
+                {
+                    const LONG previous = InterlockedCompareExchange(&entry->m_refCount, count + 1, count);
+                    if (previous == count)
+                    {
+                        return entry;
+                    }
+
+                    count = previous;
+                }
+            }
+
+            return nullptr;
+        }
+
+        void remove(detail::PathAtomEntry* entry) override
+        {
+            {
+                EResourceExclusiveLock lock(m_lock);
+
+                for (auto link = &m_buckets[entry->m_hash & (kBuckets - 1)]; *link; link = &(*link)->m_next)
+                {
+                    if (*link == entry)
+                    {
+                        *link = entry->m_next;
+                        --m_size;
+                        break;
+                    }
+                }
+            }
+
+            delete[] reinterpret_cast<std::byte*>(entry);
+        }
+
+    private:
+        EResource               m_lock;
+        detail::PathAtomEntry*  m_buckets[kBuckets] = {};
+        ULONG                   m_size = 0;
+    };
+}
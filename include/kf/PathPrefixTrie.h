@@ -0,0 +1,755 @@
+#pragma once
+#include <span>
+#include <utility>
+#include <optional>
+#include "USimpleString.h"
+
+namespace kf
+{
+    using namespace std;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////////
+    // PathPrefixTrie - compressed radix trie over path components for longest-prefix policy lookups.
+    //
+    // Keys are split by '\\' with the FilenameUtils::subpath semantics: empty components are skipped, so "\\aa\\bb",
+    // "aa\\bb\\" and "\\aa\\\\bb" are the same key. Components are compared ignoring case. A lookup costs one binary
+    // search per trie level instead of a startsWithIgnoreCase per stored prefix. Keys are stored normalized (components
+    // joined by a single '\\' without leading or trailing separators) and are returned in this form by forEach.
+    // Not thread-safe, the caller provides the synchronization like for TreeMap.
+    /*
+    PathPrefixTrie<Policy, PagedPool> policies;
+    policies.put(L"\\Device\\HarddiskVolume3\\Windows", Policy::Trusted);
+
+    USimpleString prefix;
+    if (auto policy = policies.findLongestPrefix(fileName, &prefix)) ...
+    */
+
+    template<class V, POOL_TYPE poolType>
+    class PathPrefixTrie
+    {
+    public:
+        PathPrefixTrie()
+        {
+        }
+
+        ~PathPrefixTrie()
+        {
+            clear();
+        }
+
+        PathPrefixTrie(const PathPrefixTrie&) = delete;
+        PathPrefixTrie& operator=(const PathPrefixTrie&) = delete;
+
+        NTSTATUS put(const USimpleString& key, const V& value)
+        {
+            V tmp(value);
+            return put(key, std::move(tmp));
+        }
+
+        // Replaces the value if the key is already present
+        NTSTATUS put(const USimpleString& key, V&& value)
+        {
+            Node* node = &m_root;
+            int pos = 0;
+
+            for (USimpleString component; nextComponent(key, pos, component);)
+            {
+                int index;
+                Node* child = findChild(*node, component, index);
+                if (!child)
+                {
+                    // A new leaf for the rest of the key
+                    if (!reserveChild(*node))
+                    {
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                    }
+
+                    Node* leaf = allocateNode(node->keySpan(), key, pos - component.charLength());
+                    if (!leaf)
+                    {
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                    }
+
+                    insertChild(*node, index, *leaf);
+                    return setValue(*leaf, std::move(value));
+                }
+
+                const int matchedEnd = matchLabel(*child, key, pos);
+                if (matchedEnd == child->m_keyLength)
+                {
+                    node = child;
+                    continue;
+                }
+
+                // The key diverges from the label or ends inside it: the label is split at the last matched component
+                Node* middle = allocateNode(child->keySpan().first(matchedEnd), USimpleString(), 0);
+                if (!middle || !reserveChild(*middle, 2))
+                {
+                    freeNode(middle);
+                    return STATUS_INSUFFICIENT_RESOURCES;
+                }
+
+                Node* leaf = nullptr;
+                if (!getNextComponent(key, pos).isEmpty())
+                {
+                    leaf = allocateNode(middle->keySpan(), key, pos);
+                    if (!leaf)
+                    {
+                        freeNode(middle);
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                    }
+                }
+
+                split(*node, index, *child, *middle);
+
+                if (!leaf)
+                {
+                    return setValue(*middle, std::move(value));
+                }
+
+                int leafIndex;
+                findChild(*middle, getNextComponent(key, pos), leafIndex);
+                insertChild(*middle, leafIndex, *leaf);
+
+                return setValue(*leaf, std::move(value));
+            }
+
+            return setValue(*node, std::move(value));
+        }
+
+        // Exact match
+        V* get(const USimpleString& key)
+        {
+            Node* node = findNode(key, false);
+            return node && node->m_value ? &*node->m_value : nullptr;
+        }
+
+        const V* get(const USimpleString& key) const
+        {
+            return const_cast<PathPrefixTrie*>(this)->get(key);
+        }
+
+        bool containsKey(const USimpleString& key) const
+        {
+            return get(key) != nullptr;
+        }
+
+        // Returns the value of the longest stored key that is a component prefix of the path, e.g. "\\aa\\bb" matches
+        // "\\AA\\bb\\cc" but not "\\aa\\bbcc". The optional prefix receives the matched part of the path without
+        // leading separators, that is FilenameUtils::subpath(path, 0, <matched component count>).
+        V* findLongestPrefix(const USimpleString& path, _Out_opt_ USimpleString* prefix = nullptr)
+        {
+            Node* node = &m_root;
+            Node* best = m_root.m_value ? &m_root : nullptr;
+            int bestEnd = 0;
+            int begin = -1;
+            int pos = 0;
+
+            for (USimpleString component; nextComponent(path, pos, component);)
+            {
+                if (begin < 0)
+                {
+                    begin = pos - component.charLength();
+                }
+
+                int index;
+                Node* child = findChild(*node, component, index);
+                if (!child)
+                {
+                    break;
+                }
+
+                if (matchLabel(*child, path, pos) != child->m_keyLength)
+                {
+                    break;
+                }
+
+                node = child;
+                if (node->m_value)
+                {
+                    best = node;
+                    bestEnd = pos;
+                }
+            }
+
+            if (prefix)
+            {
+                *prefix = best && best != &m_root ? USimpleString(span{ path.begin() + begin, path.begin() + bestEnd }) : USimpleString();
+            }
+
+            return best ? &*best->m_value : nullptr;
+        }
+
+        const V* findLongestPrefix(const USimpleString& path, _Out_opt_ USimpleString* prefix = nullptr) const
+        {
+            return const_cast<PathPrefixTrie*>(this)->findLongestPrefix(path, prefix);
+        }
+
+        // Calls routine(const USimpleString& key, V& value) for every key starting with the prefix components (the prefix
+        // itself included) in the compareKeys order. The trie must not be modified by the routine.
+        template<class F>
+        void forEach(const USimpleString& prefix, F&& routine)
+        {
+            Node* subtree = findNode(prefix, true);
+
+            for (Node* node = subtree; node; node = nextNode(*subtree, *node))
+            {
+                if (node->m_value)
+                {
+                    routine(USimpleString(node->keySpan()), *node->m_value);
+                }
+            }
+        }
+
+        template<class F>
+        void forEach(F&& routine)
+        {
+            forEach(USimpleString(), routine);
+        }
+
+        bool remove(const USimpleString& key)
+        {
+            Node* node = findNode(key, false);
+            if (!node || !node->m_value)
+            {
+                return false;
+            }
+
+            node->m_value.reset();
+            --m_size;
+
+            // Restore the invariant that every node without a value has at least 2 children
+            while (node != &m_root && !node->m_value && node->m_childCount < 2)
+            {
+                Node* parent = node->m_parent;
+
+                int index;
+                findChild(*parent, node->firstComponent(), index);
+                ASSERT(parent->m_children[index] == node);
+
+                if (node->m_childCount)
+                {
+                    // Merge the only child into the node's place, the child key contains the node key as a prefix
+                    Node* child = node->m_children[0];
+                    child->m_parent = parent;
+                    child->m_labelOffset = node->m_labelOffset;
+                    child->m_labelFirstEnd = node->m_labelFirstEnd;
+                    parent->m_children[index] = child;
+
+                    freeNode(node);
+                    break;
+                }
+
+                RtlMoveMemory(&parent->m_children[index], &parent->m_children[index + 1], (parent->m_childCount - index - 1) * sizeof(Node*));
+                --parent->m_childCount;
+
+                freeNode(node);
+                node = parent;
+            }
+
+            return true;
+        }
+
+        // Replaces the content with entries sorted by compareKeys without duplicates in O(n) of the total key length.
+        // The values are moved out of the entries. Returns STATUS_INVALID_PARAMETER if the entries are not sorted,
+        // the trie is empty on failure.
+        NTSTATUS build(span<pair<USimpleString, V>> entries)
+        {
+            clear();
+
+            Node* last = &m_root;
+
+            for (size_t i = 0; i < entries.size(); ++i)
+            {
+                const USimpleString& key = entries[i].first;
+
+                int common = 0;
+                int pos = 0;
+
+                if (i > 0)
+                {
+                    int order;
+                    common = commonComponents(entries[i - 1].first, key, pos, order);
+                    if (order >= 0)
+                    {
+                        clear();
+                        return STATUS_INVALID_PARAMETER;
+                    }
+                }
+
+                if (getNextComponent(key, pos).isEmpty())
+                {
+                    // Only the first key can be empty in the sorted order
+                    ASSERT(last == &m_root);
+                    setValue(m_root, std::move(entries[i].second));
+                    continue;
+                }
+
+                // Ascend the rightmost path to the node that is the parent of the new key
+                Node* node = last;
+                Node* child = nullptr;
+
+                while (node->m_depth > common)
+                {
+                    child = node;
+                    node = node->m_parent;
+                }
+
+                Node* middle = nullptr;
+                if (node->m_depth < common)
+                {
+                    const int end = componentEnd(*child, common - node->m_depth);
+
+                    middle = allocateNode(child->keySpan().first(end), USimpleString(), 0);
+                    if (!middle || !reserveChild(*middle, 2))
+                    {
+                        freeNode(middle);
+                        clear();
+                        return STATUS_INSUFFICIENT_RESOURCES;
+                    }
+                }
+
+                Node* parent = middle ? middle : node;
+                if (!reserveChild(*parent))
+                {
+                    freeNode(middle);
+                    clear();
+                    return STATUS_INSUFFICIENT_RESOURCES;
+                }
+
+                Node* leaf = allocateNode(parent->keySpan(), key, pos);
+                if (!leaf)
+                {
+                    freeNode(middle);
+                    clear();
+                    return STATUS_INSUFFICIENT_RESOURCES;
+                }
+
+                if (middle)
+                {
+                    // The child is the last one of the node as keys come in order
+                    split(*node, node->m_childCount - 1, *child, *middle);
+                }
+
+                insertChild(*parent, parent->m_childCount, *leaf);
+                setValue(*leaf, std::move(entries[i].second));
+
+                last = leaf;
+            }
+
+            return STATUS_SUCCESS;
+        }
+
+        void clear()
+        {
+            m_root.m_value.reset();
+
+            // Post-order deletion without recursion: descend to a leaf, delete it, continue from its parent
+            Node* node = &m_root;
+            while (node->m_childCount || node != &m_root)
+            {
+                if (node->m_childCount)
+                {
+                    node = node->m_children[node->m_childCount - 1];
+                    continue;
+                }
+
+                Node* parent = node->m_parent;
+                --parent->m_childCount;
+
+                freeNode(node);
+                node = parent;
+            }
+
+            delete[] m_root.m_children;
+            m_root.m_children = nullptr;
+            m_root.m_childCapacity = 0;
+
+            m_size = 0;
+        }
+
+        int size() const
+        {
+            return m_size;
+        }
+
+        bool isEmpty() const
+        {
+            return !m_size;
+        }
+
+        // Orders keys component by component ignoring case, a key goes before the keys it is a prefix of
+        static int compareKeys(const USimpleString& key1, const USimpleString& key2)
+        {
+            int pos = 0;
+            int order;
+            commonComponents(key1, key2, pos, order);
+
+            return order;
+        }
+
+    private:
+        struct Node
+        {
+            Node*           m_parent = nullptr;
+            // Sorted by the first label component
+            Node**          m_children = nullptr;
+            int             m_childCount = 0;
+            int             m_childCapacity = 0;
+            // Number of components in the key
+            int             m_depth = 0;
+            // The label is the key part that is not in the parent key, it starts at m_labelOffset
+            USHORT          m_keyLength = 0;
+            USHORT          m_labelOffset = 0;
+            USHORT          m_labelFirstEnd = 0;
+            optional<V>     m_value;
+
+            // The key follows the node in the same allocation
+            WCHAR* key()
+            {
+                return reinterpret_cast<WCHAR*>(this + 1);
+            }
+
+            span<const WCHAR> keySpan()
+            {
+                return { key(), m_keyLength };
+            }
+
+            USimpleString firstComponent()
+            {
+                return USimpleString(span{ key() + m_labelOffset, key() + m_labelFirstEnd });
+            }
+        };
+
+        // Skips separators from pos and returns the component there, pos is moved after it
+        static bool nextComponent(const USimpleString& path, _Inout_ int& pos, _Out_ USimpleString& component)
+        {
+            const int length = path.charLength();
+
+            while (pos < length && path.charAt(pos) == L'\\')
+            {
+                ++pos;
+            }
+
+            if (pos == length)
+            {
+                component = USimpleString();
+                return false;
+            }
+
+            const int begin = pos;
+            while (pos < length && path.charAt(pos) != L'\\')
+            {
+                ++pos;
+            }
+
+            component = path.substring(begin, pos);
+            return true;
+        }
+
+        static USimpleString getNextComponent(const USimpleString& path, int pos)
+        {
+            USimpleString component;
+            nextComponent(path, pos, component);
+
+            return component;
+        }
+
+        // Compares components of both keys till the first difference, pos receives the position in key2 after
+        // the common components
+        static int commonComponents(const USimpleString& key1, const USimpleString& key2, _Out_ int& pos, _Out_ int& order)
+        {
+            int pos1 = 0;
+            int count = 0;
+
+            pos = 0;
+
+            for (;;)
+            {
+                int next = pos;
+                USimpleString component1;
+                USimpleString component2;
+
+                const bool has1 = nextComponent(key1, pos1, component1);
+                const bool has2 = nextComponent(key2, next, component2);
+
+                if (!has1 || !has2)
+                {
+                    order = has1 ? 1 : has2 ? -1 : 0;
+                    return count;
+                }
+
+                order = component1.compareToIgnoreCase(component2);
+                if (order)
+                {
+                    return count;
+                }
+
+                pos = next;
+                ++count;
+            }
+        }
+
+        Node* findChild(Node& node, const USimpleString& component, _Out_ int& index)
+        {
+            int low = 0;
+            int high = node.m_childCount;
+
+            while (low < high)
+            {
+                const int middle = (low + high) / 2;
+                const int order = component.compareToIgnoreCase(node.m_children[middle]->firstComponent());
+
+                if (!order)
+                {
+                    index = middle;
+                    return node.m_children[middle];
+                }
+
+                if (order < 0)
+                {
+                    high = middle;
+                }
+                else
+                {
+                    low = middle + 1;
+                }
+            }
+
+            index = low;
+            return nullptr;
+        }
+
+        // Matches the label components after the first one (it is matched by findChild) with the path components
+        // after pos. Returns the key index where the match ended, pos is moved after the matched path components.
+        static int matchLabel(Node& node, const USimpleString& path, _Inout_ int& pos)
+        {
+            const USimpleString key(node.keySpan());
+            int keyPos = node.m_labelFirstEnd;
+
+            while (keyPos < node.m_keyLength)
+            {
+                int next = pos;
+                USimpleString component;
+                if (!nextComponent(path, next, component))
+                {
+                    break;
+                }
+
+                int nextKeyPos = keyPos + 1;
+                USimpleString label;
+                nextComponent(key, nextKeyPos, label);
+
+                if (!component.equalsIgnoreCase(label))
+                {
+                    break;
+                }
+
+                pos = next;
+                keyPos = nextKeyPos;
+            }
+
+            return keyPos;
+        }
+
+        // Returns the key index after the given number of label components
+        static int componentEnd(Node& node, int componentCount)
+        {
+            const USimpleString key(node.keySpan());
+            int pos = node.m_labelOffset;
+
+            for (USimpleString component; componentCount-- && nextComponent(key, pos, component);)
+            {
+            }
+
+            return pos;
+        }
+
+        // Returns the node for the key. A partial node is the one whose key starts with the key components while
+        // the key ends inside its label.
+        Node* findNode(const USimpleString& key, bool partial)
+        {
+            Node* node = &m_root;
+            int pos = 0;
+
+            for (USimpleString component; nextComponent(key, pos, component);)
+            {
+                int index;
+                Node* child = findChild(*node, component, index);
+                if (!child)
+                {
+                    return nullptr;
+                }
+
+                if (matchLabel(*child, key, pos) != child->m_keyLength)
+                {
+                    return partial && getNextComponent(key, pos).isEmpty() ? child : nullptr;
+                }
+
+                node = child;
+            }
+
+            return node;
+        }
+
+        // Pre-order successor within the subtree
+        Node* nextNode(Node& subtree, Node& node)
+        {
+            if (node.m_childCount)
+            {
+                return node.m_children[0];
+            }
+
+            for (Node* current = &node; current != &subtree; current = current->m_parent)
+            {
+                Node* parent = current->m_parent;
+
+                int index;
+                findChild(*parent, current->firstComponent(), index);
+
+                if (index + 1 < parent->m_childCount)
+                {
+                    return parent->m_children[index + 1];
+                }
+            }
+
+            return nullptr;
+        }
+
+        // Allocates a node with the key: parentKey, then the path components from pos joined by single separators.
+        // The node is not linked.
+        static Node* allocateNode(span<const WCHAR> parentKey, const USimpleString& path, int pos)
+        {
+            int length = static_cast<int>(parentKey.size());
+            int depth = length ? 1 : 0;
+
+            for (auto ch : parentKey)
+            {
+                depth += ch == L'\\' ? 1 : 0;
+            }
+
+            int i = pos;
+            for (USimpleString component; nextComponent(path, i, component);)
+            {
+                length += (length ? 1 : 0) + component.charLength();
+                ++depth;
+            }
+
+            auto buffer = new(poolType) std::byte[sizeof(Node) + length * sizeof(WCHAR)];
+            if (!buffer)
+            {
+                return nullptr;
+            }
+
+            auto node = new(buffer) Node();
+            node->m_keyLength = static_cast<USHORT>(length);
+            node->m_depth = depth;
+
+            WCHAR* key = node->key();
+            RtlCopyMemory(key, parentKey.data(), parentKey.size_bytes());
+            key += parentKey.size();
+
+            for (USimpleString component; nextComponent(path, pos, component);)
+            {
+                if (key != node->key())
+                {
+                    *key++ = L'\\';
+                }
+
+                RtlCopyMemory(key, component.buffer(), component.byteLength());
+                key += component.charLength();
+            }
+
+            return node;
+        }
+
+        static void freeNode(Node* node)
+        {
+            if (node)
+            {
+                delete[] node->m_children;
+                node->~Node();
+                delete[] reinterpret_cast<std::byte*>(node);
+            }
+        }
+
+        // Makes room for count more children without linking anything, so the following inserts can not fail
+        static bool reserveChild(Node& node, int count = 1)
+        {
+            if (node.m_childCount + count <= node.m_childCapacity)
+            {
+                return true;
+            }
+
+            const int capacity = max(node.m_childCapacity * 2, max(node.m_childCount + count, 4));
+
+            auto children = new(poolType) Node*[capacity];
+            if (!children)
+            {
+                return false;
+            }
+
+            if (node.m_childCount)
+            {
+                RtlCopyMemory(children, node.m_children, node.m_childCount * sizeof(Node*));
+            }
+
+            delete[] node.m_children;
+            node.m_children = children;
+            node.m_childCapacity = capacity;
+
+            return true;
+        }
+
+        static void insertChild(Node& node, int index, Node& child)
+        {
+            ASSERT(node.m_childCount < node.m_childCapacity);
+
+            RtlMoveMemory(&node.m_children[index + 1], &node.m_children[index], (node.m_childCount - index) * sizeof(Node*));
+            node.m_children[index] = &child;
+            ++node.m_childCount;
+
+            link(node, child);
+        }
+
+        // Inserts the middle node between the node and its child, the middle key is a prefix of the child key
+        static void split(Node& node, int index, Node& child, Node& middle)
+        {
+            ASSERT(node.m_children[index] == &child);
+
+            node.m_children[index] = &middle;
+            link(node, middle);
+
+            middle.m_children[0] = &child;
+            middle.m_childCount = 1;
+            link(middle, child);
+        }
+
+        // Sets the parent and the label of the child from the parent key length
+        static void link(Node& parent, Node& child)
+        {
+            child.m_parent = &parent;
+            child.m_labelOffset = static_cast<USHORT>(parent.m_keyLength ? parent.m_keyLength + 1 : 0);
+
+            int pos = child.m_labelOffset;
+            USimpleString component;
+            nextComponent(USimpleString(child.keySpan()), pos, component);
+            child.m_labelFirstEnd = static_cast<USHORT>(pos);
+        }
+
+        NTSTATUS setValue(Node& node, V&& value)
+        {
+            if (!node.m_value)
+            {
+                ++m_size;
+            }
+
+            node.m_value = std::move(value);
+            return STATUS_SUCCESS;
+        }
+
+    private:
+        Node    m_root;
+        int     m_size = 0;
+    };
+}
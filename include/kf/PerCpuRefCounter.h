@@ -0,0 +1,137 @@
+#pragma once
+#include <atomic>
+#include "RcuPtr.h"
+
+namespace kf
+{
+    using namespace std;
+
+    template<class DerivedT, int kSlots>
+    class PerCpuRefCounter;
+
+    template<class DerivedT, int kSlots>
+    void intrusive_ptr_add_ref(const PerCpuRefCounter<DerivedT, kSlots>* p) noexcept;
+
+    template<class DerivedT, int kSlots>
+    void intrusive_ptr_release(const PerCpuRefCounter<DerivedT, kSlots>* p) noexcept;
+
+    //////////////////////////////////////////////////////////////////////////
+    // PerCpuRefCounter - drop-in replacement for boost::intrusive_ref_counter with per-CPU counting.
+    //
+    // While the object is shared (per-CPU mode) intrusive_ptr copies only touch a counter slot owned by the current CPU,
+    // so the reference count line does not bounce between processors. In this mode the total is unknown and the object
+    // is never deleted. The owner calls switchToAtomic() once when the object is being retired (e.g. on context cleanup):
+    // after a grace period the per-CPU counters are folded into a single atomic counter and from then on the last
+    // release deletes the object, exactly like intrusive_ref_counter.
+    //
+    // The atomic counter is biased during the switch, so releases that race with folding can not reach zero early.
+
+    template<class DerivedT, int kSlots = 8>
+    class PerCpuRefCounter
+    {
+    public:
+        PerCpuRefCounter() noexcept
+        {
+        }
+
+        PerCpuRefCounter(const PerCpuRefCounter&) noexcept
+        {
+        }
+
+        PerCpuRefCounter& operator=(const PerCpuRefCounter&) noexcept
+        {
+            return *this;
+        }
+
+        // Exact only after switchToAtomic()
+        unsigned int use_count() const noexcept
+        {
+            LONG64 count = m_shared - kBias;
+
+            if (m_perCpu.load(memory_order_acquire))
+            {
+                for (const auto& slot : m_slots)
+                {
+                    count += slot.count;
+                }
+            }
+
+            return static_cast<unsigned int>(count);
+        }
+
+        // Must be called once at PASSIVE_LEVEL by a caller that holds a reference
+        void switchToAtomic() const
+        {
+            ASSERT(m_perCpu.load());
+
+            m_perCpu.store(false, memory_order_release);
+
+            // Every add_ref/release that saw per-CPU mode has completed after this
+            Rcu::synchronize();
+
+            LONG64 sum = 0;
+            for (const auto& slot : m_slots)
+            {
+                sum += slot.count;
+            }
+
+            ASSERT(m_shared - kBias + sum > 0);
+            InterlockedExchangeAdd64(&m_shared, sum - kBias);
+        }
+
+    protected:
+        ~PerCpuRefCounter() = default;
+
+        friend void intrusive_ptr_add_ref<DerivedT, kSlots>(const PerCpuRefCounter<DerivedT, kSlots>* p) noexcept;
+        friend void intrusive_ptr_release<DerivedT, kSlots>(const PerCpuRefCounter<DerivedT, kSlots>* p) noexcept;
+
+    private:
+        static constexpr LONG64 kBias = 1LL << 62;
+
+        struct alignas(64) Slot
+        {
+            volatile LONG64 count = 0;
+        };
+
+        // Returns false if the counter is already in atomic mode and nothing was done
+        bool addPerCpu(LONG64 value) const
+        {
+            KIRQL oldIrql;
+            KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+
+            const bool perCpu = m_perCpu.load(memory_order_acquire);
+            if (perCpu)
+            {
+                // Interlocked as several CPUs may share a slot, but the line normally stays in the local cache
+                InterlockedExchangeAdd64(&m_slots[KeGetCurrentProcessorIndex() % kSlots].count, value);
+            }
+
+            KeLowerIrql(oldIrql);
+
+            return perCpu;
+        }
+
+    private:
+        mutable Slot            m_slots[kSlots];
+        mutable volatile LONG64 m_shared = kBias;
+        mutable atomic<bool>    m_perCpu = true;
+    };
+
+    template<class DerivedT, int kSlots>
+    inline void intrusive_ptr_add_ref(const PerCpuRefCounter<DerivedT, kSlots>* p) noexcept
+    {
+        if (!p->addPerCpu(1))
+        {
+            InterlockedIncrement64(&p->m_shared);
+        }
+    }
+
+    template<class DerivedT, int kSlots>
+    inline void intrusive_ptr_release(const PerCpuRefCounter<DerivedT, kSlots>* p) noexcept
+    {
+        if (!p->addPerCpu(-1) && InterlockedDecrement64(&p->m_shared) == 0)
+        {
+            delete static_cast<const DerivedT*>(p);
+        }
+    }
+}
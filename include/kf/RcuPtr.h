@@ -0,0 +1,164 @@
+#pragma once
+#include <atomic>
+#include "boost/intrusive_ptr.hpp"
+
+namespace kf
+{
+    using namespace std;
+
+    extern "C"
+    {
+        NTKERNELAPI VOID NTAPI KeGenericCallDpc(_In_ PKDEFERRED_ROUTINE routine, _In_opt_ PVOID context);
+        NTKERNELAPI VOID NTAPI KeSignalCallDpcDone(_In_ PVOID systemArgument1);
+        NTKERNELAPI LOGICAL NTAPI KeSignalCallDpcSynchronize(_In_ PVOID systemArgument2);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // Rcu - grace period for code that runs its read-side sections at DISPATCH_LEVEL
+
+    class Rcu
+    {
+    public:
+        // Waits until every CPU has left the DISPATCH_LEVEL section it was in at the time of the call
+        static void synchronize()
+        {
+            ASSERT(KeGetCurrentIrql() == PASSIVE_LEVEL);
+            KeGenericCallDpc(&quiescentStateDpc, nullptr);
+        }
+
+    private:
+        _Function_class_(KDEFERRED_ROUTINE)
+        _IRQL_requires_(DISPATCH_LEVEL)
+        static VOID NTAPI quiescentStateDpc(_In_ PKDPC, _In_opt_ PVOID, _In_opt_ PVOID systemArgument1, _In_opt_ PVOID systemArgument2)
+        {
+            KeSignalCallDpcSynchronize(systemArgument2);
+            KeSignalCallDpcDone(systemArgument1);
+        }
+
+    private:
+        Rcu();
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // RcuPtr - read-copy-update publisher for objects with boost::intrusive_ptr semantics (e.g. derived from intrusive_ref_counter).
+    //
+    // A read-side section raises IRQL to DISPATCH_LEVEL and loads the pointer, it does no interlocked operations.
+    // A CPU that runs a DPC is therefore outside any read-side section, which is the quiescent state: the grace
+    // period ends when a DPC has run on every processor. The published object keeps one reference owned by RcuPtr,
+    // which is dropped after the grace period that follows its replacement.
+
+    template<class T>
+    class RcuPtr
+    {
+    public:
+        class ReadGuard
+        {
+        public:
+            ~ReadGuard()
+            {
+                KeLowerIrql(m_oldIrql);
+            }
+
+            ReadGuard(const ReadGuard&) = delete;
+            ReadGuard& operator=(const ReadGuard&) = delete;
+
+            T* get() const
+            {
+                return m_object;
+            }
+
+            T* operator->() const
+            {
+                ASSERT(m_object);
+                return m_object;
+            }
+
+            T& operator*() const
+            {
+                ASSERT(m_object);
+                return *m_object;
+            }
+
+            explicit operator bool() const
+            {
+                return m_object != nullptr;
+            }
+
+            // Takes a real reference for use after the read-side section ends
+            boost::intrusive_ptr<T> retain() const
+            {
+                return boost::intrusive_ptr<T>(m_object);
+            }
+
+        private:
+            friend class RcuPtr;
+
+            explicit ReadGuard(const RcuPtr& ptr)
+            {
+                ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
+
+                KeRaiseIrql(DISPATCH_LEVEL, &m_oldIrql);
+                m_object = ptr.m_object.load(memory_order_acquire);
+            }
+
+        private:
+            T*    m_object;
+            KIRQL m_oldIrql;
+        };
+
+    public:
+        RcuPtr()
+        {
+        }
+
+        explicit RcuPtr(boost::intrusive_ptr<T> object) : m_object(object.detach())
+        {
+        }
+
+        ~RcuPtr()
+        {
+            // Readers must be gone by now, so there is no need to wait for a grace period
+            boost::intrusive_ptr<T> released(m_object.exchange(nullptr, memory_order_acq_rel), false);
+        }
+
+        RcuPtr(const RcuPtr&) = delete;
+        RcuPtr& operator=(const RcuPtr&) = delete;
+
+        // The pointer returned by ReadGuard::get() must not be used after the guard is destroyed, call retain() for that
+        ReadGuard read() const
+        {
+            return ReadGuard(*this);
+        }
+
+        boost::intrusive_ptr<T> get() const
+        {
+            return read().retain();
+        }
+
+        // Publishes the new object and releases the previous one after a grace period, must be called at PASSIVE_LEVEL
+        void publish(boost::intrusive_ptr<T> object)
+        {
+            T* previous = m_object.exchange(object.detach(), memory_order_acq_rel);
+            if (previous)
+            {
+                synchronize();
+
+                boost::intrusive_ptr<T> released(previous, false);
+            }
+        }
+
+        void reset()
+        {
+            publish(boost::intrusive_ptr<T>());
+        }
+
+        // Waits until every read-side section that started before the call has ended
+        static void synchronize()
+        {
+            Rcu::synchronize();
+        }
+
+    private:
+        atomic<T*> m_object = nullptr;
+    };
+}
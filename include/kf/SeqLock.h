@@ -0,0 +1,218 @@
+#pragma once
+#include <atomic>
+#include <type_traits>
+#include "SpinLock.h"
+#include "EResource.h"
+
+namespace kf
+{
+    using namespace std;
+
+    //////////////////////////////////////////////////////////////////////////
+    // SeqLockSingleWriter - writer "lock" for SeqLock when the caller guarantees there is only one writer at a time
+
+    struct SeqLockSingleWriter
+    {
+    };
+
+    namespace detail
+    {
+        //
+        // Every writer runs the odd-sequence window at DISPATCH_LEVEL: otherwise a reader at DISPATCH_LEVEL
+        // preempting the writer on the same CPU would spin forever waiting for the sequence to become even.
+        //
+
+        template<class WriterLock>
+        class SeqLockWriteGuard;
+
+        template<>
+        class SeqLockWriteGuard<SeqLockSingleWriter>
+        {
+        public:
+            SeqLockWriteGuard(SeqLockSingleWriter&)
+            {
+                KeRaiseIrql(DISPATCH_LEVEL, &m_oldIrql);
+            }
+
+            ~SeqLockWriteGuard()
+            {
+                KeLowerIrql(m_oldIrql);
+            }
+
+            SeqLockWriteGuard(const SeqLockWriteGuard&) = delete;
+            SeqLockWriteGuard& operator=(const SeqLockWriteGuard&) = delete;
+
+        private:
+            KIRQL m_oldIrql;
+        };
+
+        template<>
+        class SeqLockWriteGuard<SpinLock>
+        {
+        public:
+            SeqLockWriteGuard(SpinLock& lock) : m_lock(lock)
+            {
+                KeAcquireSpinLock(m_lock, &m_oldIrql);
+            }
+
+            ~SeqLockWriteGuard()
+            {
+                KeReleaseSpinLock(m_lock, m_oldIrql);
+            }
+
+            SeqLockWriteGuard(const SeqLockWriteGuard&) = delete;
+            SeqLockWriteGuard& operator=(const SeqLockWriteGuard&) = delete;
+
+        private:
+            SpinLock& m_lock;
+            KIRQL     m_oldIrql;
+        };
+
+        template<>
+        class SeqLockWriteGuard<EResource>
+        {
+        public:
+            SeqLockWriteGuard(EResource& lock) : m_lock(lock)
+            {
+                ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
+
+                KeEnterCriticalRegion();
+                m_lock.acquireExclusive();
+                KeRaiseIrql(DISPATCH_LEVEL, &m_oldIrql);
+            }
+
+            ~SeqLockWriteGuard()
+            {
+                KeLowerIrql(m_oldIrql);
+                m_lock.release();
+                KeLeaveCriticalRegion();
+            }
+
+            SeqLockWriteGuard(const SeqLockWriteGuard&) = delete;
+            SeqLockWriteGuard& operator=(const SeqLockWriteGuard&) = delete;
+
+        private:
+            EResource& m_lock;
+            KIRQL      m_oldIrql;
+        };
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // SeqLock - sequence lock for small read-mostly data, readers never write shared memory and retry on a concurrent update.
+    // Readers may run at any IRQL <= DISPATCH_LEVEL. Writers are serialized by WriterLock (SpinLock, EResource or
+    // SeqLockSingleWriter) and the update itself is executed at DISPATCH_LEVEL, so it must not touch paged memory.
+
+    template<class T, class WriterLock = SpinLock>
+    class SeqLock
+    {
+    public:
+        static_assert(is_trivially_copyable_v<T>, "SeqLock readers copy the value while it may be modified, T must be trivially copyable");
+
+        struct Snapshot
+        {
+            T     value;
+            ULONG version;
+        };
+
+        SeqLock() : m_value()
+        {
+        }
+
+        explicit SeqLock(const T& value) : m_value(value)
+        {
+        }
+
+        SeqLock(const SeqLock&) = delete;
+        SeqLock& operator=(const SeqLock&) = delete;
+
+        T read() const
+        {
+            return snapshot().value;
+        }
+
+        Snapshot snapshot() const
+        {
+            Snapshot result;
+
+            for (;;)
+            {
+                if (tryRead(result))
+                {
+                    return result;
+                }
+
+                YieldProcessor();
+            }
+        }
+
+        // Single read attempt, fails if a writer was active during the copy
+        bool tryRead(_Out_ Snapshot& result) const
+        {
+            const ULONG begin = m_sequence.load(memory_order_acquire);
+            if (begin & 1)
+            {
+                return false;
+            }
+
+            RtlCopyMemory(&result.value, const_cast<const T*>(&m_value), sizeof(T));
+
+            atomic_thread_fence(memory_order_acquire);
+            if (m_sequence.load(memory_order_relaxed) != begin)
+            {
+                return false;
+            }
+
+            result.version = begin >> 1;
+            return true;
+        }
+
+        // Copies the value only if it was changed after the given version was observed
+        bool readIfChanged(_Inout_ Snapshot& snapshotValue) const
+        {
+            if (!isChanged(snapshotValue.version))
+            {
+                return false;
+            }
+
+            snapshotValue = snapshot();
+            return true;
+        }
+
+        bool isChanged(ULONG version) const
+        {
+            return (m_sequence.load(memory_order_acquire) >> 1) != version;
+        }
+
+        ULONG version() const
+        {
+            return m_sequence.load(memory_order_acquire) >> 1;
+        }
+
+        void write(const T& value)
+        {
+            update([&value](T& current) { current = value; });
+        }
+
+        // Routine is called as routine(T&) at DISPATCH_LEVEL with the writer lock held
+        template<class F>
+        void update(F&& routine)
+        {
+            detail::SeqLockWriteGuard<WriterLock> guard(m_writerLock);
+
+            const ULONG sequence = m_sequence.load(memory_order_relaxed);
+            ASSERT(!(sequence & 1));
+
+            m_sequence.store(sequence + 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+
+            routine(m_value);
+
+            m_sequence.store(sequence + 2, memory_order_release);
+        }
+
+    private:
+        atomic<ULONG>   m_sequence = 0;
+        T               m_value;
+        WriterLock      m_writerLock;
+    };
+}
@@ -0,0 +1,278 @@
+#pragma once
+#include <atomic>
+#include <span>
+#include <cstdint>
+#include <cstring>
+
+namespace kf
+{
+    using namespace std;
+
+    //////////////////////////////////////////////////////////////////////////
+    // SharedRing - single producer/single consumer ring of variable size records placed in memory shared between
+    // the driver and its user-mode service. This header has no kernel dependencies so the service can include it too.
+    //
+    // Layout: SharedRingHeader followed by the data area of `capacity` bytes (a power of 2).
+    // A record is an 8-byte SharedRingRecord followed by the payload, padded to 8 bytes. A record never wraps around:
+    // if it does not fit before the end of the data area a padding record fills the rest and the record starts at 0.
+    // head and tail are free-running byte positions, the ring is empty when they are equal.
+
+    struct SharedRingRecord
+    {
+        static constexpr uint32_t kPadding = 1;
+
+        uint32_t size;
+        uint32_t flags;
+    };
+
+    struct SharedRingHeader
+    {
+        // Written by the producer
+        alignas(64) atomic<uint64_t> head;
+        atomic<uint32_t> producerWaiting;
+
+        // Written by the consumer
+        alignas(64) atomic<uint64_t> tail;
+        atomic<uint32_t> consumerWaiting;
+
+        // Written once by the creator
+        alignas(64) uint32_t capacity;
+        atomic<uint64_t> dropped;
+    };
+
+    static_assert(sizeof(SharedRingHeader) % 64 == 0);
+
+    inline constexpr uint32_t sharedRingRecordSize(size_t payloadSize)
+    {
+        return static_cast<uint32_t>((sizeof(SharedRingRecord) + payloadSize + 7) & ~size_t(7));
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+    // SharedRingProducer
+
+    class SharedRingProducer
+    {
+    public:
+        SharedRingProducer() = default;
+
+        // Capacity is passed separately so the producer never trusts the value in shared memory
+        void attach(_Inout_ SharedRingHeader* header, uint32_t capacity)
+        {
+            m_header = header;
+            m_data = reinterpret_cast<std::byte*>(header + 1);
+            m_capacity = capacity;
+        }
+
+        void initialize(_Out_ SharedRingHeader* header, uint32_t capacity)
+        {
+            header->head.store(0, memory_order_relaxed);
+            header->producerWaiting.store(0, memory_order_relaxed);
+            header->tail.store(0, memory_order_relaxed);
+            header->consumerWaiting.store(0, memory_order_relaxed);
+            header->capacity = capacity;
+            header->dropped.store(0, memory_order_release);
+
+            attach(header, capacity);
+        }
+
+        uint32_t maxPayloadSize() const
+        {
+            return m_capacity / 4 - sizeof(SharedRingRecord);
+        }
+
+        // Returns space for the payload inside the ring or an empty span if there is no room; the payload becomes
+        // visible to the consumer on commit(). Only one reservation can be outstanding.
+        span<std::byte> reserve(size_t payloadSize)
+        {
+            if (payloadSize > maxPayloadSize())
+            {
+                return {};
+            }
+
+            const uint32_t recordSize = sharedRingRecordSize(payloadSize);
+
+            uint64_t head = m_header->head.load(memory_order_relaxed);
+            const uint64_t tail = m_header->tail.load(memory_order_acquire);
+
+            // Both positions are in memory the other side can write, broken values must not let us go past the ring
+            const uint64_t used = head - tail;
+            if (used > m_capacity || (head & 7))
+            {
+                return {};
+            }
+
+            const uint32_t offset = static_cast<uint32_t>(head & (m_capacity - 1));
+            const uint32_t contiguous = m_capacity - offset;
+            const uint32_t needed = contiguous < recordSize ? contiguous + recordSize : recordSize;
+
+            if (m_capacity - used < needed)
+            {
+                return {};
+            }
+
+            std::byte* record = m_data + offset;
+
+            if (contiguous < recordSize)
+            {
+                writeRecord(record, contiguous - sizeof(SharedRingRecord), SharedRingRecord::kPadding);
+                head += contiguous;
+                record = m_data;
+            }
+
+            writeRecord(record, static_cast<uint32_t>(payloadSize), 0);
+            m_pendingHead = head + recordSize;
+
+            return { record + sizeof(SharedRingRecord), payloadSize };
+        }
+
+        // Returns true if the consumer asked to be woken up
+        bool commit()
+        {
+            m_header->head.store(m_pendingHead, memory_order_release);
+
+            atomic_thread_fence(memory_order_seq_cst);
+            return m_header->consumerWaiting.exchange(0, memory_order_acq_rel) != 0;
+        }
+
+        bool tryWrite(span<const std::byte> payload, _Out_ bool& wakeConsumer)
+        {
+            wakeConsumer = false;
+
+            auto destination = reserve(payload.size());
+            if (destination.size() != payload.size())
+            {
+                return false;
+            }
+
+            memcpy(destination.data(), payload.data(), payload.size());
+            wakeConsumer = commit();
+
+            return true;
+        }
+
+        // Announces that the producer is going to wait for space, returns false if space appeared meanwhile
+        bool prepareWait(size_t payloadSize)
+        {
+            m_header->producerWaiting.store(1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+
+            const uint64_t used = m_header->head.load(memory_order_relaxed) - m_header->tail.load(memory_order_acquire);
+            return used <= m_capacity && m_capacity - used < 2 * sharedRingRecordSize(payloadSize);
+        }
+
+        void recordDrop()
+        {
+            m_header->dropped.fetch_add(1, memory_order_relaxed);
+        }
+
+    private:
+        static void writeRecord(std::byte* record, uint32_t size, uint32_t flags)
+        {
+            auto header = reinterpret_cast<SharedRingRecord*>(record);
+            header->size = size;
+            header->flags = flags;
+        }
+
+    private:
+        SharedRingHeader* m_header = nullptr;
+        std::byte*        m_data = nullptr;
+        uint32_t          m_capacity = 0;
+        uint64_t          m_pendingHead = 0;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // SharedRingConsumer
+
+    class SharedRingConsumer
+    {
+    public:
+        SharedRingConsumer() = default;
+
+        void attach(_Inout_ SharedRingHeader* header, uint32_t capacity)
+        {
+            m_header = header;
+            m_data = reinterpret_cast<const std::byte*>(header + 1);
+            m_capacity = capacity;
+        }
+
+        // Calls routine(span<const std::byte>) for up to maxRecords records and frees their space at once.
+        // Returns the number of records consumed, corrupted is set if the ring contents are not valid.
+        template<class F>
+        size_t consume(F&& routine, size_t maxRecords, _Out_ bool& corrupted)
+        {
+            corrupted = false;
+
+            uint64_t tail = m_header->tail.load(memory_order_relaxed);
+            const uint64_t head = m_header->head.load(memory_order_acquire);
+
+            if (head - tail > m_capacity || (tail & 7))
+            {
+                corrupted = true;
+                return 0;
+            }
+
+            size_t count = 0;
+            while (tail != head && count < maxRecords)
+            {
+                const uint32_t offset = static_cast<uint32_t>(tail & (m_capacity - 1));
+                const auto record = reinterpret_cast<const SharedRingRecord*>(m_data + offset);
+
+                // The size is checked before rounding, a size close to 4 GB would round up to a small record size. An
+                // 8-byte aligned offset always leaves room for the record header.
+                if (record->size > m_capacity - offset - sizeof(SharedRingRecord))
+                {
+                    corrupted = true;
+                    break;
+                }
+
+                const uint32_t recordSize = sharedRingRecordSize(record->size);
+                if (recordSize > m_capacity - offset || recordSize > head - tail)
+                {
+                    corrupted = true;
+                    break;
+                }
+
+                if (!(record->flags & SharedRingRecord::kPadding))
+                {
+                    routine(span<const std::byte>(m_data + offset + sizeof(SharedRingRecord), record->size));
+                    ++count;
+                }
+
+                tail += recordSize;
+            }
+
+            m_header->tail.store(tail, memory_order_release);
+
+            atomic_thread_fence(memory_order_seq_cst);
+            m_producerWaiting = m_header->producerWaiting.exchange(0, memory_order_acq_rel) != 0;
+
+            return count;
+        }
+
+        // True if the last consume() freed space the producer was waiting for
+        bool shouldWakeProducer() const
+        {
+            return m_producerWaiting;
+        }
+
+        // Announces that the consumer is going to wait, returns false if data arrived meanwhile
+        bool prepareWait()
+        {
+            m_header->consumerWaiting.store(1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+
+            return m_header->head.load(memory_order_acquire) == m_header->tail.load(memory_order_relaxed);
+        }
+
+        uint64_t dropped() const
+        {
+            return m_header->dropped.load(memory_order_relaxed);
+        }
+
+    private:
+        SharedRingHeader*       m_header = nullptr;
+        const std::byte*        m_data = nullptr;
+        uint32_t                m_capacity = 0;
+        bool                    m_producerWaiting = false;
+    };
+}
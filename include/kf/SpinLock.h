@@ -1,5 +1,8 @@
 #pragma once
 #include <wdm.h>
+#ifdef KF_LOCK_STATS
+#include "LockStats.h"
+#endif
 
 namespace kf
 {
@@ -26,11 +29,21 @@ namespace kf
             return &m_spinLock;
         }
 
+#ifdef KF_LOCK_STATS
+        LockStats& stats()
+        {
+            return m_stats;
+        }
+#endif
+
     private:
         SpinLock(const SpinLock&) = delete;
         SpinLock& operator=(const SpinLock&) = delete;
 
     private:
         KSPIN_LOCK m_spinLock;
+#ifdef KF_LOCK_STATS
+        LockStats  m_stats;
+#endif
     };
 }
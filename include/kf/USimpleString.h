@@ -2,6 +2,7 @@
 #include <utility>
 #include <span>
 #include <ntstrsafe.h>
+#include "CaseInsensitive.h"
 
 namespace kf
 {
@@ -347,7 +348,7 @@ namespace kf
 
     inline int USimpleString::compareToIgnoreCase(_In_ const UNICODE_STRING& str) const
     {
-        return ::RtlCompareUnicodeString(&m_str, &str, TRUE);
+        return CaseInsensitive::compare(m_str, str);
     }
 
     inline int USimpleString::compareToIgnoreCase(_In_ const USimpleString& str) const
@@ -367,7 +368,7 @@ namespace kf
 
     inline bool USimpleString::equalsIgnoreCase(_In_ const UNICODE_STRING& str) const
     {
-        return !!::RtlEqualUnicodeString(&m_str, &str, TRUE);
+        return CaseInsensitive::equals(m_str, str);
     }
 
     inline bool USimpleString::equalsIgnoreCase(_In_ const USimpleString& str) const
@@ -546,7 +547,7 @@ namespace kf
 
     inline bool USimpleString::startsWithIgnoreCase(_In_ const USimpleString& str) const
     {
-        return !!::RtlPrefixUnicodeString(&str.string(), &m_str, true);
+        return CaseInsensitive::startsWith(m_str, str.string());
     }
 
     inline bool USimpleString::endsWith(_In_ const USimpleString& str) const
@@ -0,0 +1,521 @@
+#pragma once
+#include <span>
+#include <utility>
+#include <type_traits>
+
+namespace kf
+{
+    using namespace std;
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////////
+    // Vector - growable array for NT kernel, inspired by std::vector.
+    //
+    // Operations that can allocate return NTSTATUS and leave the vector unchanged on failure, so it is not copyable
+    // (use assign). The capacity grows by 1.5x, elements are relocated with move construction, or with a plain memory
+    // copy for trivially copyable types. Only the constructed elements are initialized, unlike scoped_buffer::resize.
+
+    template<class T, POOL_TYPE poolType>
+    class Vector
+    {
+        static_assert(alignof(T) <= MEMORY_ALLOCATION_ALIGNMENT, "Pool allocations are not aligned enough for T");
+
+    public:
+        typedef T value_type;
+        typedef T* iterator;
+        typedef const T* const_iterator;
+
+    public:
+        Vector()
+        {
+        }
+
+        Vector(_Inout_ Vector&& another)
+        {
+            moveFrom(another);
+        }
+
+        ~Vector()
+        {
+            clear();
+            deallocate();
+        }
+
+        Vector& operator=(_Inout_ Vector&& another)
+        {
+            if (this != &another)
+            {
+                clear();
+                deallocate();
+                moveFrom(another);
+            }
+
+            return *this;
+        }
+
+        Vector(const Vector&) = delete;
+        Vector& operator=(const Vector&) = delete;
+
+        NTSTATUS assign(span<const T> elements)
+        {
+            clear();
+
+            NTSTATUS status = reserve(elements.size());
+            if (!NT_SUCCESS(status))
+            {
+                return status;
+            }
+
+            for (const auto& element : elements)
+            {
+                new(m_data + m_size) T(element);
+                ++m_size;
+            }
+
+            return STATUS_SUCCESS;
+        }
+
+        size_t size() const
+        {
+            return m_size;
+        }
+
+        size_t capacity() const
+        {
+            return m_capacity;
+        }
+
+        bool empty() const
+        {
+            return !m_size;
+        }
+
+        T* data()
+        {
+            return m_data;
+        }
+
+        const T* data() const
+        {
+            return m_data;
+        }
+
+        T& operator[](size_t index)
+        {
+            ASSERT(index < m_size);
+            return m_data[index];
+        }
+
+        const T& operator[](size_t index) const
+        {
+            ASSERT(index < m_size);
+            return m_data[index];
+        }
+
+        T& front()
+        {
+            return (*this)[0];
+        }
+
+        const T& front() const
+        {
+            return (*this)[0];
+        }
+
+        T& back()
+        {
+            return (*this)[m_size - 1];
+        }
+
+        const T& back() const
+        {
+            return (*this)[m_size - 1];
+        }
+
+        T* begin()
+        {
+            return m_data;
+        }
+
+        T* end()
+        {
+            return m_data + m_size;
+        }
+
+        const T* begin() const
+        {
+            return m_data;
+        }
+
+        const T* end() const
+        {
+            return m_data + m_size;
+        }
+
+        operator span<T>()
+        {
+            return { m_data, m_size };
+        }
+
+        operator span<const T>() const
+        {
+            return { m_data, m_size };
+        }
+
+        NTSTATUS reserve(size_t capacity)
+        {
+            return capacity > m_capacity ? reallocate(capacity) : STATUS_SUCCESS;
+        }
+
+        // Value-initializes the new elements
+        NTSTATUS resize(size_t size)
+        {
+            return resizeWith(size, [](T* element) { new(element) T(); });
+        }
+
+        // The value may refer to an element of the vector
+        NTSTATUS resize(size_t size, const T& value)
+        {
+            return resizeWith(size, [&value](T* element) { new(element) T(value); });
+        }
+
+        // Default-initializes the new elements, so trivial ones are left uninitialized for the caller to overwrite,
+        // e.g. with data read from a file
+        NTSTATUS resize_for_overwrite(size_t size)
+        {
+            return resizeWith(size, [](T* element) { new(element) T; });
+        }
+
+        NTSTATUS push_back(const T& value)
+        {
+            return emplace_back(value);
+        }
+
+        NTSTATUS push_back(T&& value)
+        {
+            return emplace_back(std::move(value));
+        }
+
+        // The arguments may refer to an element of the vector
+        template<class... Args>
+        NTSTATUS emplace_back(Args&&... args)
+        {
+            if (m_size < m_capacity)
+            {
+                new(m_data + m_size) T(std::forward<Args>(args)...);
+                ++m_size;
+
+                return STATUS_SUCCESS;
+            }
+
+            size_t capacity;
+            if (!grownCapacity(m_size + 1, capacity))
+            {
+                return STATUS_INTEGER_OVERFLOW;
+            }
+
+            T* data = allocate(capacity);
+            if (!data)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            // The new element is constructed before the old ones are relocated
+            new(data + m_size) T(std::forward<Args>(args)...);
+            relocate(m_data, m_size, data);
+
+            deallocate();
+            m_data = data;
+            m_capacity = capacity;
+            ++m_size;
+
+            return STATUS_SUCCESS;
+        }
+
+        void pop_back()
+        {
+            ASSERT(m_size);
+            m_data[--m_size].~T();
+        }
+
+        // Removes the element keeping the order of the rest
+        void erase(size_t index)
+        {
+            ASSERT(index < m_size);
+
+            for (size_t i = index + 1; i < m_size; ++i)
+            {
+                m_data[i - 1] = std::move(m_data[i]);
+            }
+
+            pop_back();
+        }
+
+        // Destroys the elements, the capacity is kept
+        void clear()
+        {
+            destroy(m_data, m_size);
+            m_size = 0;
+        }
+
+        NTSTATUS shrink_to_fit()
+        {
+            if (m_size == m_capacity || m_data == m_inline)
+            {
+                return STATUS_SUCCESS;
+            }
+
+            if (m_size <= m_inlineCapacity)
+            {
+                relocate(m_data, m_size, m_inline);
+                deallocate();
+
+                m_data = m_inline;
+                m_capacity = m_inlineCapacity;
+
+                return STATUS_SUCCESS;
+            }
+
+            return reallocate(m_size);
+        }
+
+    protected:
+        // For SmallVector: the inline buffer is used until more space is needed and is never freed
+        Vector(T* inlineBuffer, size_t inlineCapacity) : m_data(inlineBuffer), m_capacity(inlineCapacity), m_inline(inlineBuffer), m_inlineCapacity(inlineCapacity)
+        {
+        }
+
+        // Takes over the elements, the inline buffer of this vector must fit them if another uses its inline buffer
+        void moveFrom(_Inout_ Vector& another)
+        {
+            if (another.m_data && another.m_data == another.m_inline)
+            {
+                ASSERT(m_data == m_inline && another.m_size <= m_capacity);
+
+                relocate(another.m_data, another.m_size, m_data);
+                m_size = another.m_size;
+                another.m_size = 0;
+
+                return;
+            }
+
+            m_data = another.m_data;
+            m_size = another.m_size;
+            m_capacity = another.m_capacity;
+
+            another.m_data = another.m_inline;
+            another.m_size = 0;
+            another.m_capacity = another.m_inlineCapacity;
+        }
+
+    private:
+        static T* allocate(size_t capacity)
+        {
+            return static_cast<T*>(operator new(capacity * sizeof(T), poolType));
+        }
+
+        // Frees the heap buffer and switches to the inline one, the elements must be destroyed or relocated
+        void deallocate()
+        {
+            if (m_data != m_inline)
+            {
+                operator delete(m_data);
+            }
+
+            m_data = m_inline;
+            m_capacity = m_inlineCapacity;
+        }
+
+        NTSTATUS reallocate(size_t capacity)
+        {
+            ASSERT(capacity >= m_size);
+
+            if (capacity > kMaxCapacity)
+            {
+                return STATUS_INTEGER_OVERFLOW;
+            }
+
+            T* data = allocate(capacity);
+            if (!data)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            relocate(m_data, m_size, data);
+
+            deallocate();
+            m_data = data;
+            m_capacity = capacity;
+
+            return STATUS_SUCCESS;
+        }
+
+        bool grownCapacity(size_t required, _Out_ size_t& capacity) const
+        {
+            if (required > kMaxCapacity)
+            {
+                capacity = 0;
+                return false;
+            }
+
+            capacity = m_capacity <= kMaxCapacity - m_capacity / 2 ? m_capacity + m_capacity / 2 : kMaxCapacity;
+            capacity = max(max(capacity, required), size_t(4));
+
+            return true;
+        }
+
+        template<class Construct>
+        NTSTATUS resizeWith(size_t size, Construct construct)
+        {
+            if (size <= m_size)
+            {
+                destroy(m_data + size, m_size - size);
+                m_size = size;
+
+                return STATUS_SUCCESS;
+            }
+
+            if (size <= m_capacity)
+            {
+                for (; m_size < size; ++m_size)
+                {
+                    construct(m_data + m_size);
+                }
+
+                return STATUS_SUCCESS;
+            }
+
+            size_t capacity;
+            if (!grownCapacity(size, capacity))
+            {
+                return STATUS_INTEGER_OVERFLOW;
+            }
+
+            T* data = allocate(capacity);
+            if (!data)
+            {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            // The new elements are constructed before the old ones are relocated, the value may refer to one of them
+            for (size_t i = m_size; i < size; ++i)
+            {
+                construct(data + i);
+            }
+
+            relocate(m_data, m_size, data);
+
+            deallocate();
+            m_data = data;
+            m_capacity = capacity;
+            m_size = size;
+
+            return STATUS_SUCCESS;
+        }
+
+        // Moves the elements to uninitialized memory and destroys the source
+        static void relocate(T* from, size_t count, T* to)
+        {
+            if constexpr (is_trivially_copyable_v<T>)
+            {
+                if (count)
+                {
+                    RtlCopyMemory(to, from, count * sizeof(T));
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    new(to + i) T(std::move(from[i]));
+                    from[i].~T();
+                }
+            }
+        }
+
+        static void destroy(T* elements, size_t count)
+        {
+            if constexpr (!is_trivially_destructible_v<T>)
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    elements[i].~T();
+                }
+            }
+        }
+
+    private:
+        static constexpr size_t kMaxCapacity = MAXSIZE_T / sizeof(T);
+
+        T*      m_data = nullptr;
+        size_t  m_size = 0;
+        size_t  m_capacity = 0;
+        T*      m_inline = nullptr;
+        size_t  m_inlineCapacity = 0;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////////
+    // SmallVector - Vector with space for kInlineCapacity elements inside the object, the pool is used only when
+    // they do not fit. Good for short per-request lists on the stack or inside a context.
+
+    template<class T, size_t kInlineCapacity, POOL_TYPE poolType>
+    class SmallVector : private Vector<T, poolType>
+    {
+        static_assert(kInlineCapacity > 0, "Use Vector for no inline capacity");
+
+        typedef Vector<T, poolType> Base;
+
+    public:
+        using typename Base::value_type;
+        using typename Base::iterator;
+        using typename Base::const_iterator;
+
+        using Base::assign;
+        using Base::size;
+        using Base::capacity;
+        using Base::empty;
+        using Base::data;
+        using Base::operator[];
+        using Base::front;
+        using Base::back;
+        using Base::begin;
+        using Base::end;
+        using Base::reserve;
+        using Base::resize;
+        using Base::resize_for_overwrite;
+        using Base::push_back;
+        using Base::emplace_back;
+        using Base::pop_back;
+        using Base::erase;
+        using Base::clear;
+        using Base::shrink_to_fit;
+
+    public:
+        SmallVector() : Base(reinterpret_cast<T*>(m_storage), kInlineCapacity)
+        {
+        }
+
+        SmallVector(_Inout_ SmallVector&& another) : Base(reinterpret_cast<T*>(m_storage), kInlineCapacity)
+        {
+            Base::moveFrom(another);
+        }
+
+        SmallVector& operator=(_Inout_ SmallVector&& another)
+        {
+            Base::operator=(std::move(another));
+            return *this;
+        }
+
+        operator span<T>()
+        {
+            return { data(), size() };
+        }
+
+        operator span<const T>() const
+        {
+            return { data(), size() };
+        }
+
+    private:
+        alignas(T) std::byte m_storage[kInlineCapacity * sizeof(T)];
+    };
+}
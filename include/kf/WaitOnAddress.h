@@ -0,0 +1,235 @@
+#pragma once
+#include <atomic>
+#include <type_traits>
+
+namespace kf
+{
+    using namespace std;
+
+    //////////////////////////////////////////////////////////////////////////
+    // WaitOnAddress - futex-like waiting for an atomic variable to change, so objects that need "wait until this flag
+    // changes" keep only the variable (down to one byte) instead of a dispatcher object.
+    //
+    // Waiters queue a node with a KEVENT on their stack in a global table of buckets hashed by address, a bucket is
+    // guarded by its own spin lock. wait() first spins while the value is unchanged, then blocks. wakeOne()/wakeAll()
+    // return right away if nobody waits in the bucket, so the owner of the variable can call them unconditionally.
+    // The value must be changed before the wake call. The value may be changed back by the time a woken waiter runs,
+    // so the caller re-checks it in a loop:
+    /*
+    while (m_state.load() == kBusy)
+    {
+        WaitOnAddress::wait(m_state, kBusy);
+    }
+
+    // Other thread
+    m_state.store(kIdle);
+    WaitOnAddress::wakeAll(m_state);
+    */
+
+    class WaitOnAddress
+    {
+    public:
+        static constexpr ULONG kDefaultSpinCount = 128;
+
+        // Returns STATUS_SUCCESS when the value differs from compare or the waiter is woken up and STATUS_TIMEOUT when
+        // the timeout expires. Must be called at IRQL <= APC_LEVEL.
+        template<class T>
+        static NTSTATUS wait(const atomic<T>& value, type_identity_t<T> compare, _In_opt_ PLARGE_INTEGER timeout = nullptr, ULONG spinCount = kDefaultSpinCount)
+        {
+            ASSERT(KeGetCurrentIrql() <= APC_LEVEL);
+
+            for (ULONG i = 0; i < spinCount; ++i)
+            {
+                if (value.load(memory_order_acquire) != compare)
+                {
+                    return STATUS_SUCCESS;
+                }
+
+                YieldProcessor();
+            }
+
+            Bucket& bucket = bucketFor(&value);
+            Waiter waiter(&value);
+            {
+                KIRQL oldIrql;
+                KeAcquireSpinLock(&bucket.lock, &oldIrql);
+
+                bucket.append(waiter);
+
+                // The fence pairs with the one in wake: either the waker sees this waiter or the waiter sees the new value
+                atomic_thread_fence(memory_order_seq_cst);
+
+                const bool changed = value.load(memory_order_acquire) != compare;
+                if (changed)
+                {
+                    bucket.remove(waiter);
+                }
+
+                KeReleaseSpinLock(&bucket.lock, oldIrql);
+
+                if (changed)
+                {
+                    return STATUS_SUCCESS;
+                }
+            }
+
+            NTSTATUS status = KeWaitForSingleObject(&waiter.event, Executive, KernelMode, false, timeout);
+            if (status == STATUS_TIMEOUT)
+            {
+                KIRQL oldIrql;
+                KeAcquireSpinLock(&bucket.lock, &oldIrql);
+
+                const bool woken = waiter.woken;
+                if (!woken)
+                {
+                    bucket.remove(waiter);
+                }
+
+                KeReleaseSpinLock(&bucket.lock, oldIrql);
+
+                if (woken)
+                {
+                    // The waker has dequeued the node and is about to set the event, the node must live till then
+                    KeWaitForSingleObject(&waiter.event, Executive, KernelMode, false, nullptr);
+                    status = STATUS_SUCCESS;
+                }
+            }
+
+            return status;
+        }
+
+        // Wakes the longest waiting thread, can be called at IRQL <= DISPATCH_LEVEL
+        template<class T>
+        static void wakeOne(const atomic<T>& value)
+        {
+            wake(&value, false);
+        }
+
+        // Wakes all the threads waiting on the value, can be called at IRQL <= DISPATCH_LEVEL
+        template<class T>
+        static void wakeAll(const atomic<T>& value)
+        {
+            wake(&value, true);
+        }
+
+    private:
+        struct Waiter
+        {
+            explicit Waiter(const void* address) : address(address)
+            {
+                KeInitializeEvent(&event, NotificationEvent, false);
+            }
+
+            const void* address;
+            Waiter*     next = nullptr;
+            Waiter*     prev = nullptr;
+            KEVENT      event;
+            // Set under the bucket lock when a wake dequeues the waiter
+            bool        woken = false;
+        };
+
+        // Zero-initialized, so the table needs no initialization at driver load
+        struct alignas(64) Bucket
+        {
+            void append(Waiter& waiter)
+            {
+                waiter.prev = tail;
+
+                if (tail)
+                {
+                    tail->next = &waiter;
+                }
+                else
+                {
+                    head = &waiter;
+                }
+
+                tail = &waiter;
+                waiterCount.fetch_add(1, memory_order_relaxed);
+            }
+
+            void remove(Waiter& waiter)
+            {
+                (waiter.prev ? waiter.prev->next : head) = waiter.next;
+                (waiter.next ? waiter.next->prev : tail) = waiter.prev;
+
+                waiter.next = nullptr;
+                waiter.prev = nullptr;
+                waiterCount.fetch_sub(1, memory_order_relaxed);
+            }
+
+            KSPIN_LOCK      lock = 0;
+            Waiter*         head = nullptr;
+            Waiter*         tail = nullptr;
+            atomic<LONG>    waiterCount = 0;
+        };
+
+        static constexpr ULONG kBucketCount = 256;
+
+        static Bucket& bucketFor(const void* address)
+        {
+            // Fibonacci hashing, the low bits of an address are mostly the same
+            const auto hash = static_cast<ULONG64>(reinterpret_cast<ULONG_PTR>(address)) * 0x9E3779B97F4A7C15ULL;
+            return s_buckets[hash >> 56];
+        }
+
+        static void wake(const void* address, bool all)
+        {
+            Bucket& bucket = bucketFor(address);
+
+            atomic_thread_fence(memory_order_seq_cst);
+            if (!bucket.waiterCount.load(memory_order_relaxed))
+            {
+                return;
+            }
+
+            Waiter* woken = nullptr;
+            {
+                KIRQL oldIrql;
+                KeAcquireSpinLock(&bucket.lock, &oldIrql);
+
+                for (Waiter* waiter = bucket.head; waiter;)
+                {
+                    Waiter* next = waiter->next;
+
+                    if (waiter->address == address)
+                    {
+                        bucket.remove(*waiter);
+                        waiter->woken = true;
+
+                        // Chained through next for signaling outside the lock
+                        waiter->next = woken;
+                        woken = waiter;
+
+                        if (!all)
+                        {
+                            break;
+                        }
+                    }
+
+                    waiter = next;
+                }
+
+                KeReleaseSpinLock(&bucket.lock, oldIrql);
+            }
+
+            // A waiter may leave as soon as its event is set, so next is read before
+            while (woken)
+            {
+                Waiter* next = woken->next;
+                KeSetEvent(&woken->event, IO_NO_INCREMENT, false);
+                woken = next;
+            }
+        }
+
+    private:
+        static_assert(kBucketCount == 256, "bucketFor takes the top 8 bits of the hash");
+
+        static Bucket s_buckets[kBucketCount];
+
+    private:
+        WaitOnAddress();
+    };
+
+    inline WaitOnAddress::Bucket WaitOnAddress::s_buckets[WaitOnAddress::kBucketCount];
+}